@@ -19,11 +19,13 @@
 #include "libchess/Tuner.h"
 #endif
 #include "Fathom/src/tbprobe.h"
+#include "bench.h"
 #include "tt.h"
 #include "search.h"
 #include "utils.h"
 #include "eval_par.h"
 #include "eval.h"
+#include "material.h"
 #include "psq.h"
 
 bool tune_program(std::string tune_file)
@@ -68,19 +70,29 @@ void tune(std::string file)
 			for(auto & e : params)
 				cur.set_eval(e.name(), e.value());
 
-			meta_t meta;
-			std::atomic_bool ef(false);
+			// one per tuning thread, and no game history before the EPD positions
+			thread_local meta_t *tuner_meta = nullptr;
+			if (!tuner_meta) {
+				tuner_meta = new meta_t();
+				init_search_stack(tuner_meta);
+			}
+
+			meta_t & meta = *tuner_meta;
 			end_indicator_t ei;
 			ei.flag = false;
 			meta.ei = &ei;
 			meta.node_count = 0;
 			meta.max_depth = 14;
 			meta.tti = nullptr;
-			meta.bco_1st_move = meta.bco_total = 0;
-			memset(meta.hbt, 0x00, sizeof(meta.hbt)); // not changed in qs (but used by movesort!)
+			meta.ph = nullptr;  // caches are only valid for one parameter set
+			meta.ec = nullptr;
+			meta.bco_1st_move = meta.bco_total = meta.bco_before_quiets = 0;
+			memset(meta.bco_stage, 0x00, sizeof(meta.bco_stage));
+			meta.hist = nullptr;  // qs does not update it; no history ordering while tuning
 
 			libchess::Move rcm;
-			libchess::Move killers[2];
+
+			reset_search_stack(&meta, pos);
 
 			int score = qs(pos, -32767, 32767, &meta, 0, &rcm, cur);
 
@@ -127,6 +139,21 @@ void help()
 	printf("-l x   use log file x\n");
 	printf("-x x   use log file tag x\n");
 	printf("-s x   path to Syzygy files\n");
+	printf("-L     do not use (transparent) huge pages for the tt\n");
+	printf("-N x   NUMA placement of the tt: \"none\", \"interleave\" or a node number to bind to\n");
+	printf("-S x   put the tt in shared memory segment x, shared with other Micah processes using the same name; the process that creates it sets the size and removes it on exit or on \"setoption name SharedHash value <empty>\"\n");
+}
+
+void parse_numa_setting(const std::string & setting, tt_numa_policy *const policy, int *const node)
+{
+	if (setting == "interleave")
+		*policy = TT_NUMA_INTERLEAVE;
+	else if (setting.empty() == false && isdigit(setting.at(0))) {
+		*policy = TT_NUMA_BIND;
+		*node = atoi(setting.c_str());
+	}
+	else
+		*policy = TT_NUMA_NONE;
 }
 
 int main(int argc, char** argv)
@@ -135,8 +162,13 @@ int main(int argc, char** argv)
 	std::string tune_file = "tune.dat", tune_in;
 	bool go_ponder = false;
 	int hash_size = 256, n_threads = 1;
+	bool large_pages = true;
+	std::string numa_setting = "none";
+	tt_numa_policy numa_policy = TT_NUMA_NONE;
+	int numa_node = 0;
+	std::string shared_hash;
 	int c = -1;
-	while((c = getopt(argc, argv, "s:l:c:H:pt:T:x:h")) != -1) {
+	while((c = getopt(argc, argv, "s:l:c:H:pt:T:x:LN:S:h")) != -1) {
 		switch(c) {
 			case 's':
 				syzygy_files = optarg;
@@ -162,6 +194,19 @@ int main(int argc, char** argv)
 				go_ponder = true;
 				break;
 
+			case 'L':
+				large_pages = false;
+				break;
+
+			case 'N':
+				numa_setting = optarg;
+				parse_numa_setting(numa_setting, &numa_policy, &numa_node);
+				break;
+
+			case 'S':
+				shared_hash = optarg;
+				break;
+
 			case 't':
 				tune_in = optarg;
 				break;
@@ -205,6 +250,9 @@ int main(int argc, char** argv)
 		}
 	}
 
+	init_material_table(default_parameters);
+	init_search();
+
 #ifndef __ANDROID__
 	if (!tune_in.empty()) {
 		tune(tune_in);
@@ -218,12 +266,18 @@ int main(int argc, char** argv)
 		printf("# %d men syzygy\n", TB_LARGEST);
 	}
 
-	tt tti(hash_size * 1024ll * 1024ll);
+	tt tti(shared_hash.empty() ? hash_size * 1024ll * 1024ll : 0, large_pages, numa_policy, numa_node, n_threads);
+
+	if (!shared_hash.empty()) {
+		tti.set_shared_name(shared_hash);
+		tti.resize(hash_size * 1024ll * 1024ll, n_threads);
+	}
 	libchess::Position *p = new_pos();
 
 	std::vector<ponder_pars *> *pp = nullptr;
 	uint64_t pp_start_ts = 0;
 	libchess::Move pp_last_move;
+	libchess::Move pp_expected_move;  // the reply that is being pondered on
 
 	for(;;) {
 		char buffer[65536];
@@ -249,8 +303,15 @@ int main(int argc, char** argv)
 			printf("option name Threads type spin default %d min 1 max 4096\n", n_threads);
 			printf("option name SyzygyPath type string default %s\n", syzygy_files.c_str());
 			printf("option name Hash type spin default %d min 17 max 1048576\n", hash_size);
+			printf("option name LargePages type check default %s\n", large_pages ? "true" : "false");
+			printf("option name NUMA type string default %s\n", numa_setting.c_str());
+			printf("option name Clear Hash type button\n");
+			printf("option name SharedHash type string default %s\n", shared_hash.empty() ? "<empty>" : shared_hash.c_str());
 			printf("uciok\n");
 		}
+		else if (parts->at(0) == "setoption" && parts->size() == 4 && parts->at(2) == "Clear" && parts->at(3) == "Hash") {
+			tti.clear(n_threads);
+		}
 		else if (parts->at(0) == "setoption" && parts->size() >= 5) {
 			if (parts->at(2) == "SyzygyPath") {
 				if (!syzygy_files.empty())
@@ -266,9 +327,28 @@ int main(int argc, char** argv)
 				n_threads = atoi(parts->at(4).c_str());
 			}
 			else if (parts->at(2) == "Hash") {
-				hash_size = atoi(parts->at(4).c_str()) * 1024ll * 1024ll;
+				hash_size = atoi(parts->at(4).c_str());
 
-				tti.resize(hash_size);
+				tti.resize(hash_size * 1024ll * 1024ll, n_threads);
+			}
+			else if (parts->at(2) == "LargePages") {
+				large_pages = parts->at(4) == "true";
+
+				tti.set_memory_policy(large_pages, numa_policy, numa_node);
+				tti.resize(hash_size * 1024ll * 1024ll, n_threads);
+			}
+			else if (parts->at(2) == "SharedHash") {
+				shared_hash = parts->at(4) == "<empty>" ? "" : parts->at(4);
+
+				tti.set_shared_name(shared_hash);
+				tti.resize(hash_size * 1024ll * 1024ll, n_threads);
+			}
+			else if (parts->at(2) == "NUMA") {
+				numa_setting = parts->at(4);
+				parse_numa_setting(numa_setting, &numa_policy, &numa_node);
+
+				tti.set_memory_policy(large_pages, numa_policy, numa_node);
+				tti.resize(hash_size * 1024ll * 1024ll, n_threads);
 			}
 		}
 		else if (parts->at(0) == "ucinewgame") {
@@ -278,12 +358,23 @@ int main(int argc, char** argv)
 				pp_start_ts = 0;
 			}
 
+			// other processes may still be using a shared table
+			if (!tti.is_shared())
+				tti.clear(n_threads);
+
+			clear_history();
+
+			pp_last_move = pp_expected_move = libchess::Move();
+
 			delete p;
 			p = new_pos();
 		}
 		else if (parts->at(0) == "position") {
 			bool moves = false;
 
+			// only a move of this command can be a ponder hit
+			pp_last_move = libchess::Move();
+
 			for(size_t i=1; i<parts->size();) {
 				if (parts->at(i) == "fen") {
 					std::string fen;
@@ -320,7 +411,8 @@ int main(int argc, char** argv)
 						}
 					}
 
-					if (i == parts->size() - 2)
+					// the opponent's move: compared with the pondered reply
+					if (i == parts->size() - 1)
 						pp_last_move = m;
 
 					p->make_move(m);
@@ -330,6 +422,10 @@ int main(int argc, char** argv)
 				else {
 				}
 			}
+
+			// a position without moves does not continue the pondered game
+			if (!moves)
+				pp_expected_move = libchess::Move();
 		}
 		else if (parts->at(0) == "play" && parts->size() == 2) {
 			int think_time = atoi(parts -> at(1).c_str());
@@ -372,12 +468,13 @@ int main(int argc, char** argv)
 			if (pp) {
 				result_t r = stop_ponder(pp);
 
-				if (r.m != pp_last_move && r.m.value()) {
+				if (pp_expected_move.value() && pp_last_move == pp_expected_move && r.m.value()) {
 					pp_think_sub = get_ts_ms() - pp_start_ts;
 
 					dolog("ponder hit %s/%d/%d: %dms", move_to_str(r.m).c_str(), r.depth, r.score, pp_think_sub);
 				}
 
+				pp_expected_move = libchess::Move();
 				pp = nullptr;
 				pp_start_ts = 0;
 			}
@@ -401,7 +498,8 @@ int main(int argc, char** argv)
 			}
 
 			if (pp_think_sub) {
-				if (pp_think_sub > think_time)
+				// the pondering already used part of the time for this move
+				if (pp_think_sub < think_time)
 					think_time -= pp_think_sub;
 				else
 					think_time = 1;
@@ -413,12 +511,24 @@ int main(int argc, char** argv)
 
 			result_t r = lazy_smp_search(&tti, n_threads, *p, think_time, depth);
 
-			if (go_ponder) {
-				pp = ponder(&tti, *p, n_threads);
+			if (go_ponder && r.m.value()) {
+				// ponder on the position after the expected reply (the
+				// 2nd move of the pv)
+				libchess::Position ponder_pos = *p;
+				ponder_pos.make_move(r.m);
+
+				pp_expected_move = r.ponder_move;
+				if (pp_expected_move.value())
+					ponder_pos.make_move(pp_expected_move);
+
+				pp = ponder(&tti, ponder_pos, n_threads);
 				pp_start_ts = get_ts_ms();
 			}
 
-			printf("bestmove %s\n", move_to_str(r.m).c_str());
+			if (r.ponder_move.value())
+				printf("bestmove %s ponder %s\n", move_to_str(r.m).c_str(), move_to_str(r.ponder_move).c_str());
+			else
+				printf("bestmove %s\n", move_to_str(r.m).c_str());
 		}
 		/////
 		else if (parts->at(0) == "sdiv" && parts->size() == 2) {
@@ -438,6 +548,42 @@ int main(int argc, char** argv)
 				std::cout << "Move: " << move << ", score: " << r.score << ", selected move: " << r.m << ", fen: " << fen << std::endl;
 			}
 		}
+		else if (parts->at(0) == "bench") {
+			int depth = parts->size() >= 2 ? atoi(parts->at(1).c_str()) : 8;
+			bool compare_prefetch = parts->size() >= 3 && parts->at(2) == "prefetch";
+
+			benchmark_search(hash_size * 1024ll * 1024ll, depth, compare_prefetch);
+		}
+		else if (parts->at(0) == "ttsave" && parts->size() == 2) {
+			if (tti.save(parts->at(1)))
+				printf("info string tt saved to %s\n", parts->at(1).c_str());
+			else
+				printf("info string failed to save tt to %s\n", parts->at(1).c_str());
+		}
+		else if (parts->at(0) == "ttload" && parts->size() == 2) {
+			if (tti.load(parts->at(1)))
+				printf("info string tt loaded from %s\n", parts->at(1).c_str());
+			else
+				printf("info string failed to load tt from %s (format or Hash size mismatch?)\n", parts->at(1).c_str());
+		}
+		else if (parts->at(0) == "ttstats") {
+			int depth = parts->size() >= 2 ? atoi(parts->at(1).c_str()) : 10;
+			int rounds = parts->size() >= 3 ? atoi(parts->at(2).c_str()) : 4;
+			int size_mb = parts->size() >= 4 ? atoi(parts->at(3).c_str()) : 16;
+
+			benchmark_tt_replacement(size_mb * 1024ll * 1024ll, depth, rounds);
+		}
+		else if (parts->at(0) == "ttbench") {
+			int max_threads = parts->size() >= 2 ? atoi(parts->at(1).c_str()) : n_threads;
+			int size_mb = parts->size() >= 3 ? atoi(parts->at(2).c_str()) : hash_size;
+
+			benchmark_tt(size_mb * 1024ll * 1024ll, max_threads);
+		}
+		else if (parts->at(0) == "evalbench") {
+			int rounds = parts->size() >= 2 ? atoi(parts->at(1).c_str()) : 100;
+
+			benchmark_eval(rounds);
+		}
 		else if (parts->at(0) == "eval") {
 			printf("eval: %d\n", eval(*p, default_parameters));
 		}
@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "libchess/Position.h"
+#include "bench.h"
+#include "eval_par.h"
+#include "eval.h"
+#include "material.h"
+#include "psq.h"
+#include "tt.h"
+#include "search.h"
+#include "utils.h"
+
+// fixed set: opening, middle game, tactics and (pawn) endings
+static const char *const bench_fens[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+	"2r3k1/pp3ppp/4p3/3pPn2/3P4/1P3N2/P4PPP/2R3K1 b - - 0 25",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	"8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
+	nullptr
+};
+
+static uint64_t xorshift64(uint64_t *const state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+
+	return *state = x;
+}
+
+// every thread probes the same set of hot entries, like lazy smp threads
+// searching the same tree do
+void benchmark_tt(const size_t size_in_bytes, const int max_threads)
+{
+	constexpr int n_hot = 65536;
+	constexpr int duration_ms = 1000;
+
+	tt tti(size_in_bytes, true, TT_NUMA_NONE, 0, max_threads);
+
+	uint64_t seed = 0x9e3779b97f4a7c15ll;
+
+	std::vector<uint64_t> hot;
+	for(int i=0; i<n_hot; i++) {
+		uint64_t hash = xorshift64(&seed);
+
+		tti.store(hash, EXACT, 1 + i % 32, i, libchess::Move());
+
+		hot.push_back(hash);
+	}
+
+	printf("info string tt: %zu bytes, %s pages\n", tti.get_size(), tti.get_page_kind());
+
+	double single_thread = 0.;
+
+	for(int n_threads=1; n_threads<=max_threads; n_threads *= 2) {
+		std::atomic_bool stop { false };
+		std::vector<uint64_t> counts(n_threads), hit_counts(n_threads);
+		std::vector<std::thread *> threads;
+
+		for(int t=0; t<n_threads; t++) {
+			threads.push_back(new std::thread([&tti, &hot, &stop, &counts, &hit_counts, t] {
+				uint64_t state = 0x2545f4914f6cdd1dll * (t + 1);
+				uint64_t n = 0, hits = 0;
+
+				while(!stop) {
+					for(int i=0; i<1024; i++)
+						hits += tti.lookup(hot[xorshift64(&state) % n_hot]).has_value();
+
+					n += 1024;
+				}
+
+				counts[t] = n;
+				hit_counts[t] = hits;
+			}));
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+		stop = true;
+
+		uint64_t total = 0, total_hits = 0;
+		for(int t=0; t<n_threads; t++) {
+			threads.at(t)->join();
+			delete threads.at(t);
+
+			total += counts[t];
+			total_hits += hit_counts[t];
+		}
+
+		double per_second = total * 1000. / duration_ms;
+
+		if (n_threads == 1)
+			single_thread = per_second;
+
+		printf("info string threads %d lookups/s %.0f per thread %.0f scaling %.2f hit rate %.2f%%\n", n_threads, per_second, per_second / n_threads, per_second / single_thread, total_hits * 100. / total);
+
+		fflush(nullptr);
+	}
+}
+
+bench_result_t run_bench(const size_t tt_size_in_bytes, const int depth, const bool tt_prefetch, const bool verbose)
+{
+	bench_result_t result { 0, 0, 0, 0, 0 };
+
+	for(int i=0; bench_fens[i]; i++) {
+		libchess::Position pos { std::string(bench_fens[i]) };
+
+		tt tti(tt_size_in_bytes);
+		tti.set_prefetch(tt_prefetch);
+
+		// every position starts from scratch, like the tt
+		clear_history();
+
+		uint64_t start_ts = get_ts_ms();
+		result_t r = lazy_smp_search(&tti, 1, pos, -1, depth);
+		uint64_t took = get_ts_ms() - start_ts;
+
+		if (verbose)
+			printf("info string bench %d: %s nodes %ld time %lu bestmove %s\n", i, bench_fens[i], r.node_count, took, move_to_str(r.m).c_str());
+
+		result.node_count += r.node_count;
+		result.time_ms += took;
+		result.bco_total += r.bco_total;
+		result.bco_index += r.bco_index;
+#ifdef COUNT_ALLOCATIONS
+		result.allocations += r.allocations;
+#endif
+	}
+
+	return result;
+}
+
+static void print_bench_result(const char *const name, const bench_result_t & r)
+{
+	printf("info string %s: nodes %ld time %lu nps %.0f beta cut-off after %.3f avg moves\n", name, r.node_count, r.time_ms, r.node_count * 1000. / std::max(r.time_ms, uint64_t(1)), r.bco_index / double(std::max(r.bco_total, uint64_t(1))));
+
+#ifdef COUNT_ALLOCATIONS
+	// search() and qs() should not touch the heap
+	printf("info string %s: heap allocations during search %lu%s\n", name, r.allocations, r.allocations ? " (expected 0)" : "");
+#endif
+}
+
+void benchmark_search(const size_t tt_size_in_bytes, const int depth, const bool compare_prefetch)
+{
+	if (compare_prefetch) {
+		bench_result_t without = run_bench(tt_size_in_bytes, depth, false, false);
+		print_bench_result("without tt prefetch", without);
+
+		bench_result_t with = run_bench(tt_size_in_bytes, depth, true, false);
+		print_bench_result("with tt prefetch", with);
+
+		double nps_without = without.node_count * 1000. / std::max(without.time_ms, uint64_t(1));
+		double nps_with = with.node_count * 1000. / std::max(with.time_ms, uint64_t(1));
+
+		printf("info string tt prefetch nps change: %.2f%%\n", (nps_with - nps_without) * 100. / nps_without);
+	}
+	else {
+		print_bench_result("bench", run_bench(tt_size_in_bytes, depth, true, true));
+	}
+
+	fflush(nullptr);
+}
+
+// a long analysis session in a small table: the bench positions are searched
+// several times (a new "go" each, so the age increases) after which the tt
+// hit- and cut-off rates per depth are shown together with the depths of the
+// entries that survived
+void benchmark_tt_replacement(const size_t tt_size_in_bytes, const int depth, const int rounds)
+{
+	tt tti(tt_size_in_bytes);
+
+	for(int round=0; round<rounds; round++) {
+		for(int i=0; bench_fens[i]; i++) {
+			libchess::Position pos { std::string(bench_fens[i]) };
+
+			tti.inc_age();
+
+			lazy_smp_search(&tti, 1, pos, -1, depth);
+		}
+	}
+
+	const tt_stats_t & stats = tti.get_stats();
+
+	uint64_t histogram[TT_STATS_DEPTH];
+	tti.get_depth_histogram(histogram, TT_STATS_DEPTH);
+
+	for(int d=TT_QS_DEPTH; d<TT_STATS_DEPTH; d++) {  // depth 0: qs
+		if (stats.probes[d] == 0 && histogram[d] == 0)
+			continue;
+
+		printf("info string depth %d probes %lu hit rate %.2f%% cut-off rate %.2f%% entries %lu\n", d, stats.probes[d], stats.hits[d] * 100. / std::max(stats.probes[d], uint64_t(1)), stats.cutoffs[d] * 100. / std::max(stats.probes[d], uint64_t(1)), histogram[d]);
+	}
+
+	fflush(nullptr);
+}
+
+// eval() as it was before the incremental material/psq state: psq summed per
+// piece, tapered and scaled by psq_mul/psq_div per piece. kept to compare the
+// scores and the speed of the current eval() against.
+static int baseline_eval(libchess::Position & pos, const eval_par & parameters, pawn_hash *const ph, const material_entry_t *me)
+{
+	int score = 0;
+
+	material_entry_t local_material;
+
+	if (!me) {
+		int counts[2][6];
+		memset(counts, 0x00, sizeof counts);
+
+		for(libchess::Color color : libchess::constants::COLORS) {
+			for(libchess::PieceType type : libchess::constants::PIECE_TYPES)
+				counts[color][type] += pos.piece_type_bb(type, color).popcount();
+		}
+
+		local_material = material_evaluate(counts, parameters);
+		me = &local_material;
+	}
+
+	score += me->score;
+
+	pawn_entry_t local_entry, *pe = &local_entry;
+	bool pawn_hit = false;
+
+	if (ph)
+		pe = ph->lookup(pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::WHITE), pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::BLACK), &pawn_hit);
+
+	if (!pawn_hit)
+		eval_pawns(pos, parameters, pe);
+
+	score += pe->score;
+
+	int phase = me->phase;
+
+	for(libchess::Color color : libchess::constants::COLORS) {
+		for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
+			libchess::Bitboard piece_bb = pos.piece_type_bb(type, color);
+
+			int mul = color == libchess::constants::WHITE ? 1 : -1;
+
+			while (piece_bb) {
+				libchess::Square sq = piece_bb.forward_bitscan();
+				piece_bb.forward_popbit();
+				score += (psq(sq, color, type, phase) * mul * parameters.tune_psq_mul.value()) / parameters.tune_psq_div.value();
+			}
+		}
+	}
+
+	if (phase >= 224) {
+		int scores[] = { 20, 10, 5, 0, 0, 5, 10, 20 };
+
+		libchess::Square kw = pos.king_square(libchess::constants::WHITE);
+		libchess::Square kb = pos.king_square(libchess::constants::BLACK);
+
+		score += scores[kb.rank()] * parameters.tune_edge_black_rank.value();
+		score += scores[kb.file()] * parameters.tune_edge_black_file.value();
+
+		score -= scores[kw.rank()] * parameters.tune_edge_white_rank.value();
+		score -= scores[kw.file()] * parameters.tune_edge_white_file.value();
+	}
+
+	const auto bb_rooks_w = pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::WHITE);
+	const auto bb_rooks_b = pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::BLACK);
+
+	for(libchess::File x=libchess::constants::FILE_A; x<=libchess::constants::FILE_H; x++) {
+		int n_rooks_w = (bb_rooks_w & libchess::lookups::file_mask(x)).popcount();
+		int n_rooks_b = (bb_rooks_b & libchess::lookups::file_mask(x)).popcount();
+
+		bool open_w = (pe->files_without_pawns[libchess::constants::WHITE] >> x) & 1;
+		bool open_b = (pe->files_without_pawns[libchess::constants::BLACK] >> x) & 1;
+
+		score += ((open_w && n_rooks_w > 0) - (open_b && n_rooks_b > 0)) * parameters.tune_rook_on_open_file.value();
+	}
+
+	int white_king_square = pos.king_square(libchess::constants::WHITE);
+
+	if (pe->shield_king_square != white_king_square) {
+		pe->shield = king_shield(pos, libchess::constants::WHITE) - king_shield(pos, libchess::constants::BLACK);
+		pe->shield_king_square = white_king_square;
+	}
+
+	score += pe->shield * parameters.tune_king_shield.value();
+
+	if (pos.side_to_move() != libchess::constants::WHITE)
+		return -score;
+
+	return score;
+}
+
+// walks all moves (and replies) of the bench positions through do_move(),
+// verifies that the incrementally updated material/psq state matches one that
+// is computed from scratch and compares eval() with baseline_eval(): the
+// score differences and the time each takes
+void benchmark_eval(const int rounds)
+{
+	meta_t *meta = new meta_t();
+	init_search_stack(meta);
+
+	uint64_t n_positions = 0, n_mismatches = 0;
+	uint64_t n_different = 0;
+	int max_difference = 0;
+	uint64_t total_difference = 0;
+
+	std::vector<libchess::Position> positions;
+
+	for(int i=0; bench_fens[i]; i++) {
+		libchess::Position pos { std::string(bench_fens[i]) };
+
+		reset_search_stack(meta, pos);
+
+		for(auto move : pos.legal_move_list()) {
+			do_move(pos, meta, move);
+
+			for(auto reply : pos.legal_move_list()) {
+				do_move(pos, meta, reply);
+
+				material_state_t verify;
+				material_init(&verify, pos);
+
+				const material_state_t & incremental = meta->stack[meta->ply].material;
+
+				if (memcmp(verify.counts, incremental.counts, sizeof verify.counts) || verify.key != incremental.key || verify.psq != incremental.psq) {
+					if (n_mismatches == 0)
+						printf("info string incremental state mismatch after %s %s in %s\n", move_to_str(move).c_str(), move_to_str(reply).c_str(), bench_fens[i]);
+
+					n_mismatches++;
+				}
+
+				int difference = abs(eval(pos, default_parameters, nullptr, &incremental) - baseline_eval(pos, default_parameters, nullptr, material_probe(incremental)));
+				n_different += difference != 0;
+				max_difference = std::max(max_difference, difference);
+				total_difference += difference;
+
+				if (positions.size() < 4096)
+					positions.push_back(pos);
+
+				n_positions++;
+
+				undo_move(pos, meta);
+			}
+
+			undo_move(pos, meta);
+		}
+	}
+
+	printf("info string positions %lu state mismatches %lu score differs from the baseline eval for %lu: max %d avg %.3f\n", n_positions, n_mismatches, n_different, max_difference, total_difference / double(std::max(n_positions, uint64_t(1))));
+
+	std::vector<material_state_t> states(positions.size());
+	for(size_t i=0; i<positions.size(); i++)
+		material_init(&states[i], positions[i]);
+
+	volatile int sink = 0;
+
+	uint64_t start_ts = get_ts_ms();
+	for(int r=0; r<rounds; r++) {
+		for(size_t i=0; i<positions.size(); i++)
+			sink = sink + eval(positions[i], default_parameters, nullptr, &states[i]);
+	}
+	uint64_t took_incremental = get_ts_ms() - start_ts;
+
+	// the baseline got the material entry from the search, like eval() now
+	// takes it from the state
+	start_ts = get_ts_ms();
+	for(int r=0; r<rounds; r++) {
+		for(size_t i=0; i<positions.size(); i++)
+			sink = sink + baseline_eval(positions[i], default_parameters, nullptr, material_probe(states[i]));
+	}
+	uint64_t took_baseline = get_ts_ms() - start_ts;
+
+	uint64_t n_evals = uint64_t(rounds) * positions.size();
+
+	printf("info string evals %lu with incremental state: %lu ms (%.0f/s), baseline: %lu ms (%.0f/s)\n", n_evals, took_incremental, n_evals * 1000. / std::max(took_incremental, uint64_t(1)), took_baseline, n_evals * 1000. / std::max(took_baseline, uint64_t(1)));
+
+	fflush(nullptr);
+
+	delete meta;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+void benchmark_tt(const size_t size_in_bytes, const int max_threads);
+
+typedef struct
+{
+	long int node_count;
+	uint64_t time_ms;
+	uint64_t bco_total, bco_index;
+	uint64_t allocations;  // by search() and qs(); only counted with COUNT_ALLOCATIONS
+} bench_result_t;
+
+bench_result_t run_bench(const size_t tt_size_in_bytes, const int depth, const bool tt_prefetch, const bool verbose);
+void benchmark_search(const size_t tt_size_in_bytes, const int depth, const bool compare_prefetch);
+void benchmark_tt_replacement(const size_t tt_size_in_bytes, const int depth, const int rounds);
+void benchmark_eval(const int rounds);
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include "libchess/Position.h"
+#include "cuckoo.h"
+
+#define CUCKOO_SIZE 8192
+
+static uint64_t cuckoo_keys[CUCKOO_SIZE];
+static uint16_t cuckoo_moves[CUCKOO_SIZE];  // from | to << 6
+
+static int cuckoo_h1(const uint64_t key) { return key & (CUCKOO_SIZE - 1); }
+static int cuckoo_h2(const uint64_t key) { return (key >> 16) & (CUCKOO_SIZE - 1); }
+
+// fen of a board with only the given pieces (square, fen letter)
+static std::string make_fen(const std::pair<int, char> *const pieces, const int n, const char side)
+{
+	char board[64];
+	std::fill(board, board + 64, '.');
+
+	for(int i=0; i<n; i++)
+		board[pieces[i].first] = pieces[i].second;
+
+	std::string fen;
+
+	for(int rank=7; rank>=0; rank--) {
+		int empty = 0;
+
+		for(int file=0; file<8; file++) {
+			char c = board[rank * 8 + file];
+
+			if (c == '.') {
+				empty++;
+				continue;
+			}
+
+			if (empty)
+				fen += char('0' + empty);
+			empty = 0;
+
+			fen += c;
+		}
+
+		if (empty)
+			fen += char('0' + empty);
+
+		if (rank)
+			fen += '/';
+	}
+
+	return fen + " " + side + " - - 0 1";
+}
+
+static bool next_to(const int a, const int b)
+{
+	return abs((a & 7) - (b & 7)) <= 1 && abs((a >> 3) - (b >> 3)) <= 1;
+}
+
+// libchess does not export its zobrist keys: derive the difference of a
+// move from the hashes of two boards with the piece on "from" and on "to"
+static uint64_t move_key(const libchess::PieceType type, const libchess::Color color, const int from, const int to)
+{
+	static const char letters[] = "pnbrqk";
+	const int c = color;
+	char letter = c == libchess::constants::WHITE ? toupper(letters[type]) : letters[type];
+
+	// kings that stay where they are (their keys cancel out)
+	const int corners[] = { 0, 7, 56, 63, 27, 36 };
+	int kings[2] = { -1, -1 };
+
+	for(int side=0; side<2; side++) {
+		if (type == libchess::constants::KING && side == c)
+			continue;
+
+		for(int sq : corners) {
+			if (sq == from || sq == to || (kings[!side] != -1 && next_to(sq, kings[!side])))
+				continue;
+
+			kings[side] = sq;
+			break;
+		}
+	}
+
+	std::pair<int, char> pieces[3];
+	int n = 0;
+
+	for(int side=0; side<2; side++) {
+		if (kings[side] != -1)
+			pieces[n++] = { kings[side], side == libchess::constants::WHITE ? 'K' : 'k' };
+	}
+
+	pieces[n] = { from, letter };
+	uint64_t key_from = libchess::Position(make_fen(pieces, n + 1, 'w')).hash();
+
+	pieces[n] = { to, letter };
+	uint64_t key_to = libchess::Position(make_fen(pieces, n + 1, 'b')).hash();
+
+	return key_from ^ key_to;
+}
+
+void init_cuckoo()
+{
+	for(int i=0; i<CUCKOO_SIZE; i++) {
+		cuckoo_keys[i] = 0;
+		cuckoo_moves[i] = 0;
+	}
+
+	for(libchess::Color color : { libchess::constants::WHITE, libchess::constants::BLACK }) {
+		for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
+			if (type == libchess::constants::PAWN)
+				continue;
+
+			for(int from=0; from<64; from++) {
+				libchess::Bitboard targets = libchess::lookups::non_pawn_piece_type_attacks(type, libchess::Square(from), libchess::Bitboard(0));
+
+				while(targets) {
+					int to = targets.forward_bitscan();
+					targets.forward_popbit();
+
+					// each pair once; the table is searched both ways
+					if (to < from)
+						continue;
+
+					uint64_t key = move_key(type, color, from, to);
+					uint16_t move = from | (to << 6);
+
+					// insert, kicking out what is in the way to its other slot
+					int slot = cuckoo_h1(key);
+
+					for(;;) {
+						std::swap(cuckoo_keys[slot], key);
+						std::swap(cuckoo_moves[slot], move);
+
+						if (key == 0)
+							break;
+
+						slot = slot == cuckoo_h1(key) ? cuckoo_h2(key) : cuckoo_h1(key);
+					}
+				}
+			}
+		}
+	}
+}
+
+bool cuckoo_lookup(const uint64_t key_diff, libchess::Square *const from, libchess::Square *const to)
+{
+	int slot = cuckoo_h1(key_diff);
+
+	if (cuckoo_keys[slot] != key_diff) {
+		slot = cuckoo_h2(key_diff);
+
+		if (cuckoo_keys[slot] != key_diff)
+			return false;
+	}
+
+	*from = libchess::Square(cuckoo_moves[slot] & 63);
+	*to   = libchess::Square(cuckoo_moves[slot] >> 6);
+
+	return true;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+#include "libchess/Position.h"
+
+// the hash differences of all reversible moves (a non-pawn piece going from
+// one square to another on an empty board, plus the side to move) in a cuckoo
+// table. if the key of the current position xor that of an earlier one is in
+// it, a single move can recreate the earlier position.
+void init_cuckoo();
+
+// is "key_diff" the difference of a reversible move? "from" and "to" receive
+// its squares (the piece can be on either of them)
+bool cuckoo_lookup(const uint64_t key_diff, libchess::Square *const from, libchess::Square *const to);
@@ -4,6 +4,8 @@
 #include "libchess/Position.h"
 #include "eval_par.h"
 #include "eval.h"
+#include "material.h"
+#include "pawn_hash.h"
 #include "psq.h"
 
 int eval_piece(libchess::PieceType piece, const eval_par & parameters)
@@ -13,7 +15,7 @@ int eval_piece(libchess::PieceType piece, const eval_par & parameters)
 	return values[piece];
 }
 
-int game_phase(int counts[2][6], const eval_par & parameters)
+int game_phase(const int counts[2][6], const eval_par & parameters)
 {
         const int num_knights = counts[libchess::constants::WHITE][libchess::constants::KNIGHT] + counts[libchess::constants::BLACK][libchess::constants::KNIGHT];
         const int num_bishops = counts[libchess::constants::WHITE][libchess::constants::BISHOP] + counts[libchess::constants::BLACK][libchess::constants::BISHOP];
@@ -203,113 +205,77 @@ int development(libchess::Position & pos)
 	return score;
 }
 
-int eval(libchess::Position & pos, const eval_par & parameters)
+// everything that depends on the pawns only (and, for the shield, on the
+// white king square), so that it can be cached in the pawn hash
+void eval_pawns(libchess::Position & pos, const eval_par & parameters, pawn_entry_t *const e)
 {
 	int score = 0;
 
-	int counts[2][6];
-	memset(counts, 0x00, sizeof counts);
+	const auto bb_pawns_w = pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::WHITE);
+	const auto bb_pawns_b = pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::BLACK);
 
 	int whiteYmax[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
         int blackYmin[8] = { 8, 8, 8, 8, 8, 8, 8, 8 };
 
-	for(libchess::Color color : libchess::constants::COLORS) {
-		for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
-			libchess::Bitboard piece_bb = pos.piece_type_bb(type, color);
-
-			counts[color][type] += piece_bb.popcount();
+	libchess::Bitboard piece_bb = bb_pawns_w;
+	while (piece_bb) {
+		libchess::Square sq = piece_bb.forward_bitscan();
+		piece_bb.forward_popbit();
 
-			if (type == libchess::constants::PAWN) {
-				while (piece_bb) {
-					libchess::Square sq = piece_bb.forward_bitscan();
-					piece_bb.forward_popbit();
-
-					int x = sq.file();
-					int y = sq.rank();
-
-					if (color == libchess::constants::WHITE)
-						whiteYmax[x] = std::max(whiteYmax[x], y);
-					else
-						blackYmin[x] = std::min(blackYmin[x], y);
-				}
-			}
-		}
+		whiteYmax[sq.file()] = std::max(whiteYmax[sq.file()], int(sq.rank()));
 	}
 
-	int phase = game_phase(counts, parameters);
-
-	for(libchess::Color color : libchess::constants::COLORS) {
-		for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
-			libchess::Bitboard piece_bb = pos.piece_type_bb(type, color);
-
-			int mul = color == libchess::constants::WHITE ? 1 : -1;
-
-			// material
-			score += eval_piece(type, parameters) * piece_bb.popcount() * mul;
-
-			// psq
-			while (piece_bb) {
-				libchess::Square sq = piece_bb.forward_bitscan();
-				piece_bb.forward_popbit();
-				score += (psq(sq, color, type, phase) * mul * parameters.tune_psq_mul.value()) / parameters.tune_psq_div.value();
-
-				// passed pawns
-				if (type == libchess::constants::PAWN) {
-					int x = sq.file();
-					int y = sq.rank();
-
-					if (color == libchess::constants::WHITE) {
-						bool left = (x > 0 && (blackYmin[x - 1] <= y || blackYmin[x - 1] == 8)) || x == 0;
-						bool front = blackYmin[x] < y || blackYmin[x] == 8;
-						bool right = (x < 7 && (blackYmin[x + 1] <= y || blackYmin[x + 1] == 8)) || x == 7;
-
-						if (left && front && right)
-							score += parameters.tune_pp_scores[false][y].value();
-						//score += (parameters.tune_pp_scores[0][y].value() * (256 - phase) + parameters.tune_pp_scores[1][y].value() * phase) / 256;
-					}
-					else {
-						bool left = (x > 0 && (whiteYmax[x - 1] >= y || whiteYmax[x - 1] == -1)) || x == 0;
-						bool front = whiteYmax[x] > y || whiteYmax[x] == -1;
-						bool right = (x < 7 && (whiteYmax[x + 1] >= y || whiteYmax[x + 1] == -1)) || x == 7;
-
-						if (left && front && right)
-							score -= parameters.tune_pp_scores[false][7 - y].value();
-						// score -= (parameters.tune_pp_scores[0][7 - y].value() * (256 - phase) + parameters.tune_pp_scores[1][7 - y].value() * phase) / 256;
-					}
-				}
-			}
-		}
+	piece_bb = bb_pawns_b;
+	while (piece_bb) {
+		libchess::Square sq = piece_bb.forward_bitscan();
+		piece_bb.forward_popbit();
+
+		blackYmin[sq.file()] = std::min(blackYmin[sq.file()], int(sq.rank()));
 	}
 
-	if (phase >= 224) { // endgame?
-		int scores[] = { 20, 10, 5, 0, 0, 5, 10, 20 };  
+	// passed pawns
+	piece_bb = bb_pawns_w;
+	while (piece_bb) {
+		libchess::Square sq = piece_bb.forward_bitscan();
+		piece_bb.forward_popbit();
 
-		libchess::Square kw = pos.king_square(libchess::constants::WHITE);
-		libchess::Square kb = pos.king_square(libchess::constants::BLACK);
+		int x = sq.file();
+		int y = sq.rank();
 
-		score += scores[kb.rank()] * parameters.tune_edge_black_rank.value();
-		score += scores[kb.file()] * parameters.tune_edge_black_file.value();
+		bool left = (x > 0 && (blackYmin[x - 1] <= y || blackYmin[x - 1] == 8)) || x == 0;
+		bool front = blackYmin[x] < y || blackYmin[x] == 8;
+		bool right = (x < 7 && (blackYmin[x + 1] <= y || blackYmin[x + 1] == 8)) || x == 7;
 
-		score -= scores[kw.rank()] * parameters.tune_edge_white_rank.value();
-		score -= scores[kw.file()] * parameters.tune_edge_white_file.value();
+		if (left && front && right)
+			score += parameters.tune_pp_scores[false][y].value();
+		//score += (parameters.tune_pp_scores[0][y].value() * (256 - phase) + parameters.tune_pp_scores[1][y].value() * phase) / 256;
 	}
 
-	// score += development(pos) * parameters.tune_development.value();
+	piece_bb = bb_pawns_b;
+	while (piece_bb) {
+		libchess::Square sq = piece_bb.forward_bitscan();
+		piece_bb.forward_popbit();
 
-	// forks
-	//score += find_forks(pos);
+		int x = sq.file();
+		int y = sq.rank();
 
-	// number of bishops
-	score += ((counts[libchess::constants::WHITE][libchess::constants::BISHOP] >= 2) - (counts[libchess::constants::BLACK][libchess::constants::BISHOP] >= 2)) * parameters.tune_bishop_count.value();
+		bool left = (x > 0 && (whiteYmax[x - 1] >= y || whiteYmax[x - 1] == -1)) || x == 0;
+		bool front = whiteYmax[x] > y || whiteYmax[x] == -1;
+		bool right = (x < 7 && (whiteYmax[x + 1] >= y || whiteYmax[x + 1] == -1)) || x == 7;
+
+		if (left && front && right)
+			score -= parameters.tune_pp_scores[false][7 - y].value();
+		// score -= (parameters.tune_pp_scores[0][7 - y].value() * (256 - phase) + parameters.tune_pp_scores[1][7 - y].value() * phase) / 256;
+	}
+
+	const int n_w = bb_pawns_w.popcount();
+	const int n_b = bb_pawns_b.popcount();
 
 	// 8 pawns: not good
-	score += ((counts[libchess::constants::WHITE][libchess::constants::PAWN] == 8) - (counts[libchess::constants::BLACK][libchess::constants::PAWN] == 8)) * parameters.tune_too_many_pawns.value();
+	score += ((n_w == 8) - (n_b == 8)) * parameters.tune_too_many_pawns.value();
 
 	// 0 pawns: also not good
-	score += ((counts[libchess::constants::WHITE][libchess::constants::PAWN] == 0) - (counts[libchess::constants::BLACK][libchess::constants::PAWN] == 0)) * parameters.tune_zero_pawns.value();
-
-	const auto bb_pawns_w = pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::WHITE);
-	const auto bb_pawns_b = pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::BLACK);
+	score += ((n_w == 0) - (n_b == 0)) * parameters.tune_zero_pawns.value();
 
 	int n_pawns_w[8], n_pawns_b[8];
 
@@ -319,8 +285,7 @@ int eval(libchess::Position & pos, const eval_par & parameters)
 		n_pawns_b[x] = (bb_pawns_b & libchess::lookups::file_mask(x)).popcount();
 	}
 
-	const auto bb_rooks_w = pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::WHITE);
-	const auto bb_rooks_b = pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::BLACK);
+	e->files_without_pawns[libchess::constants::WHITE] = e->files_without_pawns[libchess::constants::BLACK] = 0;
 
 	for(libchess::File x=libchess::constants::FILE_A; x<=libchess::constants::FILE_H; x++) {
 		// double pawns
@@ -329,11 +294,9 @@ int eval(libchess::Position & pos, const eval_par & parameters)
 		if (n_pawns_b[x] >= 2)
 			score += (n_pawns_b[x] - 1) * parameters.tune_double_pawns.value();
 
-		// rooks on open files
-		int n_rooks_w = (bb_rooks_w & libchess::lookups::file_mask(x)).popcount();
-		int n_rooks_b = (bb_rooks_b & libchess::lookups::file_mask(x)).popcount();
-
-		score += ((n_pawns_w[x] == 0 && n_rooks_w > 0) - (n_pawns_b[x] == 0 && n_rooks_b > 0)) * parameters.tune_rook_on_open_file.value();
+		// for rooks on open files
+		e->files_without_pawns[libchess::constants::WHITE] |= (n_pawns_w[x] == 0) << x;
+		e->files_without_pawns[libchess::constants::BLACK] |= (n_pawns_b[x] == 0) << x;
 
 		// isolated pawns
 		int wleft = x > 0 ? n_pawns_w[x - 1] : 0;
@@ -345,11 +308,107 @@ int eval(libchess::Position & pos, const eval_par & parameters)
 		score -= (bleft == 0 && bright == 0) * parameters.tune_isolated_pawns.value();
 	}
 
+	e->white_pawns = bb_pawns_w;
+	e->black_pawns = bb_pawns_b;
+	e->score = score;
+	e->shield_king_square = -1;
+}
+
+int eval(libchess::Position & pos, const eval_par & parameters, pawn_hash *const ph, const material_state_t *ms)
+{
+	int score = 0;
+
+	material_state_t local_state;
+
+	if (!ms) {
+		material_init(&local_state, pos);
+		ms = &local_state;
+	}
+
+	// the material table holds values for the default parameters
+	const material_entry_t *me = &parameters == &default_parameters ? material_probe(*ms) : nullptr;
+	material_entry_t local_material;
+
+	if (!me) {
+		int counts[2][6];
+
+		for(int color=0; color<2; color++) {
+			for(int type=0; type<6; type++)
+				counts[color][type] = ms->counts[color][type];
+		}
+
+		local_material = material_evaluate(counts, parameters);
+		me = &local_material;
+	}
+
+	// material, bishop pair
+	score += me->score;
+
+	pawn_entry_t local_entry, *pe = &local_entry;
+	bool pawn_hit = false;
+
+	if (ph)
+		pe = ph->lookup(pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::WHITE), pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::BLACK), &pawn_hit);
+
+	if (!pawn_hit)
+		eval_pawns(pos, parameters, pe);
+
+	score += pe->score;
+
+	int phase = me->phase;
+
+	// psq: one tapered interpolation of the running mg/eg sums. this rounds
+	// once instead of once per piece (twice: taper, then psq_mul/psq_div),
+	// so scores differ from the per piece sum by a few units; "evalbench"
+	// reports by how much
+	int psq_score = (psq_mg(ms->psq) * (255 - phase) + psq_eg(ms->psq) * phase) / 256;
+	score += (psq_score * parameters.tune_psq_mul.value()) / parameters.tune_psq_div.value();
+
+	if (phase >= 224) { // endgame?
+		int scores[] = { 20, 10, 5, 0, 0, 5, 10, 20 };  
+
+		libchess::Square kw = pos.king_square(libchess::constants::WHITE);
+		libchess::Square kb = pos.king_square(libchess::constants::BLACK);
+
+		score += scores[kb.rank()] * parameters.tune_edge_black_rank.value();
+		score += scores[kb.file()] * parameters.tune_edge_black_file.value();
+
+		score -= scores[kw.rank()] * parameters.tune_edge_white_rank.value();
+		score -= scores[kw.file()] * parameters.tune_edge_white_file.value();
+	}
+
+	// score += development(pos) * parameters.tune_development.value();
+
+	// forks
+	//score += find_forks(pos);
+
+	const auto bb_rooks_w = pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::WHITE);
+	const auto bb_rooks_b = pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::BLACK);
+
+	// rooks on open files
+	for(libchess::File x=libchess::constants::FILE_A; x<=libchess::constants::FILE_H; x++) {
+		int n_rooks_w = (bb_rooks_w & libchess::lookups::file_mask(x)).popcount();
+		int n_rooks_b = (bb_rooks_b & libchess::lookups::file_mask(x)).popcount();
+
+		bool open_w = (pe->files_without_pawns[libchess::constants::WHITE] >> x) & 1;
+		bool open_b = (pe->files_without_pawns[libchess::constants::BLACK] >> x) & 1;
+
+		score += ((open_w && n_rooks_w > 0) - (open_b && n_rooks_b > 0)) * parameters.tune_rook_on_open_file.value();
+	}
+
 	// score += count_mobility(pos) * parameters.tune_mobility.value() / 10;
 
 	// score -= (count_king_attacks(pos, libchess::constants::WHITE) - count_king_attacks(pos, libchess::constants::BLACK)) * parameters.tune_king_attacks.value();
 
-	score += (king_shield(pos, libchess::constants::WHITE) - king_shield(pos, libchess::constants::BLACK)) * parameters.tune_king_shield.value();
+	// king_shield() only looks at the white king and the pawns
+	int white_king_square = pos.king_square(libchess::constants::WHITE);
+
+	if (pe->shield_king_square != white_king_square) {
+		pe->shield = king_shield(pos, libchess::constants::WHITE) - king_shield(pos, libchess::constants::BLACK);
+		pe->shield_king_square = white_king_square;
+	}
+
+	score += pe->shield * parameters.tune_king_shield.value();
 
 	if (pos.side_to_move() != libchess::constants::WHITE)
 		return -score;
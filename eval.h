@@ -1,2 +1,9 @@
+#include "pawn_hash.h"
+
+struct material_state_t;
+
 extern int eval_piece(libchess::PieceType piece, const eval_par & parameters);
-extern int eval(libchess::Position & pos, const eval_par & parameters);
+extern int game_phase(const int counts[2][6], const eval_par & parameters);
+extern int eval(libchess::Position & pos, const eval_par & parameters, pawn_hash *const ph = nullptr, const material_state_t *ms = nullptr);
+extern void eval_pawns(libchess::Position & pos, const eval_par & parameters, pawn_entry_t *const e);
+extern int king_shield(libchess::Position & pos, libchess::Color side);
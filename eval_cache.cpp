@@ -0,0 +1,41 @@
+#include <cstdint>
+#include <cstring>
+
+#include "eval_cache.h"
+
+eval_cache::eval_cache(const uint64_t n_entries) : n_entries(n_entries), n_lookups(0), n_hits(0)
+{
+	entries = new eval_cache_entry_t[n_entries];
+
+	memset(entries, 0x00, sizeof(eval_cache_entry_t) * n_entries);
+}
+
+eval_cache::~eval_cache()
+{
+	delete [] entries;
+}
+
+bool eval_cache::lookup(const uint64_t hash, int *const score)
+{
+	const eval_cache_entry_t & e = entries[hash & (n_entries - 1)];
+
+	n_lookups++;
+
+	if (e.valid && e.hash == hash) {
+		*score = e.score;
+		n_hits++;
+
+		return true;
+	}
+
+	return false;
+}
+
+void eval_cache::store(const uint64_t hash, const int score)
+{
+	eval_cache_entry_t & e = entries[hash & (n_entries - 1)];
+
+	e.hash = hash;
+	e.score = score;
+	e.valid = true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+typedef struct
+{
+	uint64_t hash;
+	int32_t score;
+	int32_t valid;
+} eval_cache_entry_t;
+
+// per thread cache of eval() results, indexed by the board hash; only
+// valid for the parameter set that filled it
+class eval_cache
+{
+private:
+	eval_cache_entry_t *entries;
+	uint64_t n_entries;  // power of 2
+
+	uint64_t n_lookups, n_hits;
+
+public:
+	eval_cache(const uint64_t n_entries);
+	~eval_cache();
+
+	bool lookup(const uint64_t hash, int *const score);
+	void store(const uint64_t hash, const int score);
+
+	uint64_t get_lookups() const { return n_lookups; }
+	uint64_t get_hits() const { return n_hits; }
+};
@@ -0,0 +1,76 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "libchess/Position.h"
+#include "history.h"
+
+history::history()
+{
+	clear();
+}
+
+void history::clear()
+{
+	memset(butterfly, 0x00, sizeof butterfly);
+	memset(capture, 0x00, sizeof capture);
+	memset(continuation, 0x00, sizeof continuation);
+}
+
+static void halve(int16_t *const p, const size_t n)
+{
+	for(size_t i=0; i<n; i++)
+		p[i] /= 2;
+}
+
+void history::age()
+{
+	halve(&butterfly[0][0][0], sizeof(butterfly) / sizeof(int16_t));
+	halve(&capture[0][0][0], sizeof(capture) / sizeof(int16_t));
+	halve(&continuation[0][0][0][0], sizeof(continuation) / sizeof(int16_t));
+}
+
+void history::update(int16_t & entry, const int bonus)
+{
+	entry += bonus - entry * abs(bonus) / HISTORY_MAX;
+}
+
+int history::quiet_score(const libchess::Color side, const libchess::Piece piece, const libchess::Move move, const continuation_history_t *const cont1, const continuation_history_t *const cont2) const
+{
+	const int index = history_piece_index(piece);
+	const libchess::Square to = move.to_square();
+
+	int score = butterfly[side][move.from_square()][to];
+
+	if (cont1)
+		score += (*cont1)[index][to];
+
+	if (cont2)
+		score += (*cont2)[index][to];
+
+	return score;
+}
+
+void history::update_quiet(const libchess::Color side, const libchess::Piece piece, const libchess::Move move, continuation_history_t *const cont1, continuation_history_t *const cont2, const int bonus)
+{
+	const int index = history_piece_index(piece);
+	const libchess::Square to = move.to_square();
+
+	update(butterfly[side][move.from_square()][to], bonus);
+
+	if (cont1)
+		update((*cont1)[index][to], bonus);
+
+	if (cont2)
+		update((*cont2)[index][to], bonus);
+}
+
+int history::capture_score(const libchess::Piece piece, const libchess::Move move, const libchess::PieceType captured) const
+{
+	return capture[history_piece_index(piece)][move.to_square()][captured];
+}
+
+void history::update_capture(const libchess::Piece piece, const libchess::Move move, const libchess::PieceType captured, const int bonus)
+{
+	update(capture[history_piece_index(piece)][move.to_square()][captured], bonus);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "libchess/Position.h"
+
+#define HISTORY_MAX 16384
+
+// [piece][to] of a move, for one previous move
+typedef int16_t continuation_history_t[12][64];
+
+inline int history_piece_index(const libchess::Piece piece) { return piece.color() * 6 + piece.type(); }
+
+// move ordering statistics of one search thread. they are kept between
+// iterations and moves: updates use "gravity" (entry += bonus - entry *
+// |bonus| / HISTORY_MAX) so that entries stay within +/- HISTORY_MAX and
+// old information fades as new bonuses and maluses come in.
+class history
+{
+private:
+	int16_t butterfly[2][64][64];        // [color][from][to]
+	int16_t capture[12][64][6];          // [piece][to][captured piece type]
+	continuation_history_t continuation[12][64];  // [previous piece][previous to]
+
+	static void update(int16_t & entry, const int bonus);
+
+public:
+	history();
+
+	void clear();
+	void age();  // halves everything, at the start of a new search
+
+	// the table of the moves that follow "move" (played by "piece")
+	continuation_history_t *get_continuation(const libchess::Piece piece, const libchess::Move move) { return &continuation[history_piece_index(piece)][move.to_square()]; }
+
+	// cont1/cont2: get_continuation() of the moves 1 and 2 plies ago, may be nullptr
+	int quiet_score(const libchess::Color side, const libchess::Piece piece, const libchess::Move move, const continuation_history_t *const cont1, const continuation_history_t *const cont2) const;
+	void update_quiet(const libchess::Color side, const libchess::Piece piece, const libchess::Move move, continuation_history_t *const cont1, continuation_history_t *const cont2, const int bonus);
+
+	int capture_score(const libchess::Piece piece, const libchess::Move move, const libchess::PieceType captured) const;
+	void update_capture(const libchess::Piece piece, const libchess::Move move, const libchess::PieceType captured, const int bonus);
+};
+
+// bonus (and, negated, malus) for a move that did (not) give a cut-off at "depth"
+inline int history_bonus(const int depth) { return depth * depth * 32 < HISTORY_MAX / 4 ? depth * depth * 32 : HISTORY_MAX / 4; }
@@ -0,0 +1,353 @@
+#include <cstdint>
+#include <cstdlib>
+
+#include "libchess/Position.h"
+#include "legality.h"
+
+bool is_legal_move(const libchess::Position & pos, const libchess::Move move)
+{
+	const libchess::Color side = pos.side_to_move();
+	const libchess::Color them = !side;
+
+	const libchess::Square from = move.from_square();
+	const libchess::Square to   = move.to_square();
+
+	libchess::Bitboard from_bb(from);
+	libchess::Bitboard to_bb(to);
+	libchess::Bitboard captured_bb = to_bb;
+
+	if (move.type() == libchess::Move::Type::ENPASSANT)
+		captured_bb = libchess::Bitboard(side == libchess::constants::WHITE ? to - 8 : to + 8);
+
+	// the board after the move: only the occupancy and the pieces that
+	// survive matter
+	libchess::Bitboard occupancy = (pos.occupancy_bb() ^ from_bb ^ captured_bb) | to_bb;
+
+	auto piece = pos.piece_on(from);
+
+	libchess::Square king = piece->type() == libchess::constants::KING ? to : pos.king_square(side);
+
+	libchess::Bitboard survivors = ~captured_bb;
+
+	libchess::Bitboard bishops = (pos.piece_type_bb(libchess::constants::BISHOP, them) | pos.piece_type_bb(libchess::constants::QUEEN, them)) & survivors;
+	libchess::Bitboard rooks   = (pos.piece_type_bb(libchess::constants::ROOK,   them) | pos.piece_type_bb(libchess::constants::QUEEN, them)) & survivors;
+
+	if (libchess::lookups::bishop_attacks(king, occupancy) & bishops)
+		return false;
+
+	if (libchess::lookups::rook_attacks(king, occupancy) & rooks)
+		return false;
+
+	if (libchess::lookups::knight_attacks(king) & pos.piece_type_bb(libchess::constants::KNIGHT, them) & survivors)
+		return false;
+
+	if (libchess::lookups::pawn_attacks(king, side) & pos.piece_type_bb(libchess::constants::PAWN, them) & survivors)
+		return false;
+
+	if (libchess::lookups::king_attacks(king) & pos.piece_type_bb(libchess::constants::KING, them))
+		return false;
+
+	return true;
+}
+
+bool gives_check(const libchess::Position & pos, const libchess::Move move)
+{
+	if (move.type() == libchess::Move::Type::CASTLING || move.type() == libchess::Move::Type::ENPASSANT || move.promotion_piece_type())
+		return true;
+
+	const libchess::Color side = pos.side_to_move();
+
+	const libchess::Square from = move.from_square();
+	const libchess::Square to   = move.to_square();
+	const libchess::Square king = pos.king_square(!side);
+
+	const libchess::PieceType type = pos.piece_on(from)->type();
+
+	libchess::Bitboard from_bb(from);
+	libchess::Bitboard occupancy = (pos.occupancy_bb() ^ from_bb) | libchess::Bitboard(to);
+
+	// directly, by the piece that moves
+	if (type == libchess::constants::PAWN) {
+		if (libchess::lookups::pawn_attacks(to, side) & libchess::Bitboard(king))
+			return true;
+	}
+	else if (type != libchess::constants::KING && (libchess::lookups::non_pawn_piece_type_attacks(type, to, occupancy) & libchess::Bitboard(king)))
+		return true;
+
+	// discovered: a slider behind the square that is left
+	libchess::Bitboard bishops = (pos.piece_type_bb(libchess::constants::BISHOP, side) | pos.piece_type_bb(libchess::constants::QUEEN, side)) & ~from_bb;
+	libchess::Bitboard rooks   = (pos.piece_type_bb(libchess::constants::ROOK,   side) | pos.piece_type_bb(libchess::constants::QUEEN, side)) & ~from_bb;
+
+	return (libchess::lookups::bishop_attacks(king, occupancy) & bishops) || (libchess::lookups::rook_attacks(king, occupancy) & rooks);
+}
+
+void legality_init(legality_t *const lg, const libchess::Position & pos)
+{
+	const libchess::Color side = pos.side_to_move();
+	const libchess::Color them = !side;
+
+	lg->king     = pos.king_square(side);
+	lg->checkers = pos.checkers_to(side);
+	lg->pinned   = libchess::Bitboard(0);
+
+	const libchess::Bitboard occupancy = pos.occupancy_bb();
+	const libchess::Bitboard own = pos.color_bb(side);
+
+	libchess::Bitboard queens = pos.piece_type_bb(libchess::constants::QUEEN, them);
+
+	// sliders that would attack the king on an empty board, with exactly
+	// one own piece in between
+	libchess::Bitboard snipers = (libchess::lookups::bishop_attacks(lg->king, libchess::Bitboard(0)) & (pos.piece_type_bb(libchess::constants::BISHOP, them) | queens)) |
+		(libchess::lookups::rook_attacks(lg->king, libchess::Bitboard(0)) & (pos.piece_type_bb(libchess::constants::ROOK, them) | queens));
+
+	while(snipers) {
+		libchess::Square sniper = snipers.forward_bitscan();
+		snipers.forward_popbit();
+
+		libchess::Bitboard between = libchess::lookups::intervening(lg->king, sniper) & occupancy;
+
+		if (between.popcount() == 1 && (between & own))
+			lg->pinned |= between;
+	}
+
+	if (!lg->checkers)
+		lg->check_mask = ~libchess::Bitboard(0);
+	else if (lg->checkers.popcount() == 1) {
+		libchess::Square checker = lg->checkers.forward_bitscan();
+
+		lg->check_mask = libchess::lookups::intervening(lg->king, checker) | lg->checkers;
+	}
+	else {
+		lg->check_mask = libchess::Bitboard(0);  // only the king can move
+	}
+}
+
+bool is_legal_move(const libchess::Position & pos, const legality_t & lg, const libchess::Move move)
+{
+	const libchess::Square from = move.from_square();
+
+	// the king can walk into an attack and en passant removes two pieces
+	// from a line: those are rare enough for the full test
+	if (from == lg.king || move.type() == libchess::Move::Type::ENPASSANT)
+		return is_legal_move(pos, move);
+
+	const libchess::Square to = move.to_square();
+	const libchess::Bitboard to_bb(to);
+
+	if (!(lg.check_mask & to_bb))
+		return false;
+
+	if (lg.pinned & libchess::Bitboard(from)) {
+		// stays on the line through the king
+		return (libchess::lookups::intervening(lg.king, to) & libchess::Bitboard(from)) ||
+			(libchess::lookups::intervening(lg.king, from) & to_bb);
+	}
+
+	return true;
+}
+
+// adds from -> to for a non castling, non en passant move, with the
+// promotions when a pawn reaches the last rank
+static void add_move(const libchess::Position & pos, libchess::MoveList & ml, const libchess::Square from, const libchess::Square to, const bool is_pawn)
+{
+	const bool is_capture = pos.piece_on(to).has_value();
+
+	if (is_pawn && (to.rank() == 0 || to.rank() == 7)) {
+		for(libchess::PieceType promotion : { libchess::constants::QUEEN, libchess::constants::ROOK, libchess::constants::BISHOP, libchess::constants::KNIGHT })
+			ml.add(libchess::Move(from, to, promotion, is_capture ? libchess::Move::Type::CAPTURE_PROMOTION : libchess::Move::Type::PROMOTION));
+	}
+	else if (is_pawn && abs(int(to) - int(from)) == 16)
+		ml.add(libchess::Move(from, to, libchess::Move::Type::DOUBLE_PUSH));
+	else
+		ml.add(libchess::Move(from, to, is_capture ? libchess::Move::Type::CAPTURE : libchess::Move::Type::NORMAL));
+}
+
+void generate_evasions(const libchess::Position & pos, const legality_t & lg, libchess::MoveList & ml)
+{
+	const libchess::Color side = pos.side_to_move();
+
+	const libchess::Bitboard occupancy = pos.occupancy_bb();
+	const libchess::Bitboard own = pos.color_bb(side);
+
+	// king steps
+	libchess::Bitboard targets = libchess::lookups::king_attacks(lg.king) & ~own;
+
+	while(targets) {
+		libchess::Square to = targets.forward_bitscan();
+		targets.forward_popbit();
+
+		libchess::Move move(lg.king, to, pos.piece_on(to).has_value() ? libchess::Move::Type::CAPTURE : libchess::Move::Type::NORMAL);
+
+		if (is_legal_move(pos, move))
+			ml.add(move);
+	}
+
+	// double check
+	if (!lg.check_mask)
+		return;
+
+	// capture the checker or block the line; a pinned piece can never do
+	// either
+	libchess::Bitboard movers = own & ~lg.pinned & ~pos.piece_type_bb(libchess::constants::KING, side);
+
+	const libchess::Bitboard pawns = pos.piece_type_bb(libchess::constants::PAWN, side);
+	const int forward = side == libchess::constants::WHITE ? 8 : -8;
+	const int double_push_rank = side == libchess::constants::WHITE ? 1 : 6;
+
+	while(movers) {
+		libchess::Square from = movers.forward_bitscan();
+		movers.forward_popbit();
+
+		if (pawns & libchess::Bitboard(from)) {
+			libchess::Bitboard captures = libchess::lookups::pawn_attacks(from, side) & lg.checkers;
+
+			if (captures)
+				add_move(pos, ml, from, captures.forward_bitscan(), true);
+
+			libchess::Square push = from + forward;
+
+			if (!(occupancy & libchess::Bitboard(push))) {
+				if (lg.check_mask & libchess::Bitboard(push))
+					add_move(pos, ml, from, push, true);
+
+				libchess::Square double_push = push + forward;
+
+				if (from.rank() == double_push_rank && !(occupancy & libchess::Bitboard(double_push)) && (lg.check_mask & libchess::Bitboard(double_push)))
+					add_move(pos, ml, from, double_push, true);
+			}
+
+			auto ep = pos.enpassant_square();
+
+			if (ep.has_value() && (libchess::lookups::pawn_attacks(from, side) & libchess::Bitboard(*ep))) {
+				libchess::Move move(from, *ep, libchess::Move::Type::ENPASSANT);
+
+				if (is_legal_move(pos, move))
+					ml.add(move);
+			}
+		}
+		else {
+			libchess::PieceType type = pos.piece_on(from)->type();
+
+			libchess::Bitboard destinations = libchess::lookups::non_pawn_piece_type_attacks(type, from, occupancy) & lg.check_mask & ~own;
+
+			while(destinations) {
+				libchess::Square to = destinations.forward_bitscan();
+				destinations.forward_popbit();
+
+				add_move(pos, ml, from, to, false);
+			}
+		}
+	}
+}
+
+libchess::Move unpack_move(const libchess::Position & pos, const uint16_t packed_move)
+{
+	if (packed_move == 0)
+		return libchess::Move();
+
+	const libchess::Square from(packed_move & 63);
+	const libchess::Square to((packed_move >> 6) & 63);
+	const int promotion = packed_move >> 12;
+
+	if (from == to || promotion > libchess::constants::QUEEN)
+		return libchess::Move();
+
+	const libchess::Color side = pos.side_to_move();
+
+	auto piece = pos.piece_on(from);
+	if (!piece.has_value() || piece->color() != side)
+		return libchess::Move();
+
+	auto victim = pos.piece_on(to);
+	if (victim.has_value() && (victim->color() == side || victim->type() == libchess::constants::KING))
+		return libchess::Move();
+
+	const libchess::PieceType type = piece->type();
+
+	libchess::Move move;
+
+	if (type == libchess::constants::PAWN) {
+		const int forward = side == libchess::constants::WHITE ? 8 : -8;
+		const int last_rank = side == libchess::constants::WHITE ? 7 : 0;
+		const int double_push_rank = side == libchess::constants::WHITE ? 1 : 6;
+
+		const bool is_promotion = to.rank() == last_rank;
+
+		if (is_promotion != (promotion != 0))
+			return libchess::Move();
+
+		if (libchess::lookups::pawn_attacks(from, side) & libchess::Bitboard(to)) {
+			if (victim.has_value()) {
+				if (is_promotion)
+					move = libchess::Move(from, to, libchess::PieceType(promotion), libchess::Move::Type::CAPTURE_PROMOTION);
+				else
+					move = libchess::Move(from, to, libchess::Move::Type::CAPTURE);
+			}
+			else if (pos.enpassant_square() == to) {
+				move = libchess::Move(from, to, libchess::Move::Type::ENPASSANT);
+			}
+			else {
+				return libchess::Move();
+			}
+		}
+		else if (to == from + forward && !victim.has_value()) {
+			if (is_promotion)
+				move = libchess::Move(from, to, libchess::PieceType(promotion), libchess::Move::Type::PROMOTION);
+			else
+				move = libchess::Move(from, to, libchess::Move::Type::NORMAL);
+		}
+		else if (to == from + 2 * forward && from.rank() == double_push_rank && !victim.has_value() && !pos.piece_on(from + forward).has_value()) {
+			move = libchess::Move(from, to, libchess::Move::Type::DOUBLE_PUSH);
+		}
+		else {
+			return libchess::Move();
+		}
+	}
+	else {
+		if (promotion)
+			return libchess::Move();
+
+		if (type == libchess::constants::KING && abs(int(to) - int(from)) == 2) {
+			const bool king_side = to > from;
+			const int home = side == libchess::constants::WHITE ? 0 : 56;
+
+			if (int(from) != home + 4)
+				return libchess::Move();
+
+			libchess::CastlingRight right = side == libchess::constants::WHITE ?
+				(king_side ? libchess::constants::CASTLING_WHITE_KINGSIDE : libchess::constants::CASTLING_WHITE_QUEENSIDE) :
+				(king_side ? libchess::constants::CASTLING_BLACK_KINGSIDE : libchess::constants::CASTLING_BLACK_QUEENSIDE);
+
+			if (!pos.castling_rights().is_allowed(right))
+				return libchess::Move();
+
+			// f+g or b+c+d must be empty
+			libchess::Bitboard between((king_side ? 0x60ull : 0x0eull) << home);
+
+			if (pos.occupancy_bb() & between)
+				return libchess::Move();
+
+			// the king may not start in, pass through or end up in check
+			const int step = king_side ? 1 : -1;
+
+			for(int i=0; i<3; i++) {
+				if (pos.attackers_to(libchess::Square(int(from) + i * step), !side))
+					return libchess::Move();
+			}
+
+			return libchess::Move(from, to, libchess::Move::Type::CASTLING);
+		}
+
+		libchess::Bitboard attacks = type == libchess::constants::KING ? libchess::lookups::king_attacks(from) : libchess::lookups::non_pawn_piece_type_attacks(type, from, pos.occupancy_bb());
+
+		if (!(attacks & libchess::Bitboard(to)))
+			return libchess::Move();
+
+		move = libchess::Move(from, to, victim.has_value() ? libchess::Move::Type::CAPTURE : libchess::Move::Type::NORMAL);
+	}
+
+	if (!is_legal_move(pos, move))
+		return libchess::Move();
+
+	return move;
+}
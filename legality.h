@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "libchess/Position.h"
+
+// computed once per node so that most pseudo legal moves can be checked
+// with a few bit operations instead of a make_move() / unmake_move()
+typedef struct
+{
+	libchess::Square king;
+	libchess::Bitboard checkers;
+	libchess::Bitboard pinned;      // own pieces that may only move along the line to the king
+	libchess::Bitboard check_mask;  // squares that capture or block the checker; all squares when not in check
+} legality_t;
+
+void legality_init(legality_t *const lg, const libchess::Position & pos);
+
+// does "move" (pseudo legal, not castling) leave the own king attacked?
+bool is_legal_move(const libchess::Position & pos, const libchess::Move move);
+// idem, using the pins and checkers of the node
+bool is_legal_move(const libchess::Position & pos, const legality_t & lg, const libchess::Move move);
+
+// does "move" (pseudo legal, quiet or capture) check the opponent? castling,
+// en passant and promotions are assumed to
+bool gives_check(const libchess::Position & pos, const libchess::Move move);
+
+// the legal moves when in check
+void generate_evasions(const libchess::Position & pos, const legality_t & lg, libchess::MoveList & ml);
+
+// turns a tt_pack_move()ed move (tt move, killer, ...) back into a move of
+// "pos" without generating the moves of the position; returns a move with
+// value 0 if it is not legal there (e.g. after a hash collision)
+libchess::Move unpack_move(const libchess::Position & pos, const uint16_t packed_move);
@@ -0,0 +1,196 @@
+#include <cstdint>
+#include <cstring>
+
+#include "libchess/Position.h"
+#include "eval_par.h"
+#include "eval.h"
+#include "material.h"
+#include "psq.h"
+
+static material_entry_t material_table[MATERIAL_KEYS_PER_SIDE * MATERIAL_KEYS_PER_SIDE];
+
+// number of different counts the table holds per piece type (king: not counted)
+static constexpr int radix[6] = { 9, 3, 3, 3, 2, 1 };
+
+static uint32_t side_key(const int counts[6])
+{
+	uint32_t key = 0, stride = 1;
+
+	for(int type=0; type<5; type++) {
+		if (counts[type] < 0 || counts[type] >= radix[type])
+			return MATERIAL_KEY_INVALID;
+
+		key += counts[type] * stride;
+		stride *= radix[type];
+	}
+
+	return key;
+}
+
+static uint32_t material_key(const int counts[2][6])
+{
+	uint32_t white = side_key(counts[libchess::constants::WHITE]);
+	uint32_t black = side_key(counts[libchess::constants::BLACK]);
+
+	if (white == MATERIAL_KEY_INVALID || black == MATERIAL_KEY_INVALID)
+		return MATERIAL_KEY_INVALID;
+
+	return white + black * MATERIAL_KEYS_PER_SIDE;
+}
+
+material_entry_t material_evaluate(const int counts[2][6], const eval_par & parameters)
+{
+	material_entry_t e { };
+
+	int score = 0;
+
+	for(libchess::Color color : libchess::constants::COLORS) {
+		int mul = color == libchess::constants::WHITE ? 1 : -1;
+
+		for(libchess::PieceType type : libchess::constants::PIECE_TYPES)
+			score += eval_piece(type, parameters) * counts[color][type] * mul;
+	}
+
+	// number of bishops
+	score += ((counts[libchess::constants::WHITE][libchess::constants::BISHOP] >= 2) - (counts[libchess::constants::BLACK][libchess::constants::BISHOP] >= 2)) * parameters.tune_bishop_count.value();
+
+	e.score = score;
+	e.phase = game_phase(counts, parameters);
+
+	// bare kings, or one minor piece against a bare king
+	int n_heavy_or_pawns = 0, n_minor = 0;
+	for(libchess::Color color : libchess::constants::COLORS) {
+		n_heavy_or_pawns += counts[color][libchess::constants::PAWN] + counts[color][libchess::constants::ROOK] + counts[color][libchess::constants::QUEEN];
+		n_minor += counts[color][libchess::constants::KNIGHT] + counts[color][libchess::constants::BISHOP];
+	}
+
+	if (n_heavy_or_pawns == 0 && n_minor <= 1)
+		e.flags |= MATERIAL_FLAG_DRAW;
+
+	return e;
+}
+
+// needs to be redone when the parameters change (e.g. after loading a tune file)
+void init_material_table(const eval_par & parameters)
+{
+	int counts[2][6];
+
+	for(uint32_t white=0; white<MATERIAL_KEYS_PER_SIDE; white++) {
+		for(uint32_t black=0; black<MATERIAL_KEYS_PER_SIDE; black++) {
+			uint32_t w = white, b = black;
+
+			for(int type=0; type<6; type++) {
+				counts[libchess::constants::WHITE][type] = w % radix[type];
+				w /= radix[type];
+
+				counts[libchess::constants::BLACK][type] = b % radix[type];
+				b /= radix[type];
+			}
+
+			counts[libchess::constants::WHITE][libchess::constants::KING] = counts[libchess::constants::BLACK][libchess::constants::KING] = 1;
+
+			material_table[white + black * MATERIAL_KEYS_PER_SIDE] = material_evaluate(counts, parameters);
+		}
+	}
+}
+
+static uint32_t state_key(const material_state_t & ms)
+{
+	int counts[2][6];
+
+	for(int color=0; color<2; color++) {
+		for(int type=0; type<6; type++)
+			counts[color][type] = ms.counts[color][type];
+	}
+
+	return material_key(counts);
+}
+
+void material_init(material_state_t *const ms, const libchess::Position & pos)
+{
+	ms->psq = 0;
+
+	for(libchess::Color color : libchess::constants::COLORS) {
+		for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
+			libchess::Bitboard piece_bb = pos.piece_type_bb(type, color);
+
+			ms->counts[color][type] = piece_bb.popcount();
+
+			while (piece_bb) {
+				libchess::Square sq = piece_bb.forward_bitscan();
+				piece_bb.forward_popbit();
+
+				ms->psq += color == libchess::constants::WHITE ? psq_packed(sq, color, type) : -psq_packed(sq, color, type);
+			}
+		}
+	}
+
+	ms->key = state_key(*ms);
+}
+
+// must be invoked before the move is made on pos
+void material_update(material_state_t *const ms, const libchess::Position & pos, const libchess::Move move)
+{
+	const libchess::Color side = pos.side_to_move();
+	const int mul = side == libchess::constants::WHITE ? 1 : -1;
+
+	const libchess::Square from = move.from_square();
+	const libchess::Square to = move.to_square();
+	const libchess::PieceType type = pos.piece_on(from)->type();
+
+	bool changed = false;
+
+	if (pos.is_capture_move(move)) {
+		libchess::PieceType victim = libchess::constants::PAWN;
+		libchess::Square victim_sq = to;
+
+		if (move.type() == libchess::Move::Type::ENPASSANT)
+			victim_sq = side == libchess::constants::WHITE ? to - 8 : to + 8;
+		else
+			victim = pos.piece_on(to)->type();
+
+		ms->counts[!side][victim]--;
+		ms->psq += mul * psq_packed(victim_sq, !side, victim);  // removes a piece of the opponent
+		changed = true;
+	}
+
+	ms->psq -= mul * psq_packed(from, side, type);
+
+	if (pos.is_promotion_move(move)) {
+		libchess::PieceType promotion = *move.promotion_piece_type();
+
+		ms->counts[side][libchess::constants::PAWN]--;
+		ms->counts[side][promotion]++;
+		ms->psq += mul * psq_packed(to, side, promotion);
+		changed = true;
+	}
+	else {
+		ms->psq += mul * psq_packed(to, side, type);
+	}
+
+	if (move.type() == libchess::Move::Type::CASTLING) {
+		// the king moves two squares, the rook jumps over it
+		bool king_side = to.file() == 6;
+		libchess::Square rook_from = king_side ? to + 1 : to - 2;
+		libchess::Square rook_to = king_side ? to - 1 : to + 1;
+
+		ms->psq += mul * (psq_packed(rook_to, side, libchess::constants::ROOK) - psq_packed(rook_from, side, libchess::constants::ROOK));
+	}
+
+	if (changed)
+		ms->key = state_key(*ms);
+}
+
+const material_entry_t *material_probe(const material_state_t & ms)
+{
+	if (ms.key == MATERIAL_KEY_INVALID)
+		return nullptr;
+
+	return &material_table[ms.key];
+}
+
+bool material_is_draw(const material_state_t & ms)
+{
+	// counts outside of the table always mean enough material to mate
+	return ms.key != MATERIAL_KEY_INVALID && (material_table[ms.key].flags & MATERIAL_FLAG_DRAW);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#include "libchess/Position.h"
+#include "eval_par.h"
+
+// per side: 0...8 pawns, 0...2 knights, bishops and rooks, 0...1 queens
+#define MATERIAL_KEYS_PER_SIDE (9 * 3 * 3 * 3 * 2)
+#define MATERIAL_KEY_INVALID   0xffffffff
+
+#define MATERIAL_FLAG_DRAW 1  // insufficient material
+
+typedef struct material_entry_t
+{
+	int32_t score;  // material and bishop pair, from white's point of view
+	uint16_t phase;  // game_phase()
+	uint8_t flags;
+} material_entry_t;
+
+// piece counts and psq sum of a position, kept up to date while searching
+typedef struct material_state_t
+{
+	int8_t counts[2][6];
+	uint32_t key;  // index in the material table, MATERIAL_KEY_INVALID if the counts are out of its range
+	int32_t psq;  // psq_pack()ed mg/eg sum, white minus black
+} material_state_t;
+
+void init_material_table(const eval_par & parameters);
+material_entry_t material_evaluate(const int counts[2][6], const eval_par & parameters);
+
+void material_init(material_state_t *const ms, const libchess::Position & pos);
+void material_update(material_state_t *const ms, const libchess::Position & pos, const libchess::Move move);
+
+// nullptr when the counts are outside of the table (e.g. after an under promotion)
+const material_entry_t *material_probe(const material_state_t & ms);
+bool material_is_draw(const material_state_t & ms);
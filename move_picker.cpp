@@ -0,0 +1,259 @@
+#include <utility>
+
+#include "libchess/Position.h"
+#include "eval_par.h"
+#include "eval.h"
+#include "legality.h"
+#include "move_picker.h"
+#include "psq.h"
+#include "see.h"
+#include "tt.h"
+
+void move_buffer_init(move_buffer_t *const buffer)
+{
+	buffer->generated.values().reserve(MP_MAX_MOVES);
+}
+
+move_picker::move_picker(libchess::Position & pos, const legality_t & lg, const eval_par & pars, const history *const hist, const continuation_history_t *const cont1, const continuation_history_t *const cont2, const libchess::Move tt_move, const libchess::Move *const killers, const libchess::Move countermove, const bool captures_only, move_buffer_t *const buffer) :
+	pos(pos), lg(lg), pars(pars), hist(hist), cont1(cont1), cont2(cont2), tt_move(tt_move), captures_only(captures_only), stage(MP_STAGE_TT), kind(MP_KIND_TT), buffer(buffer), n_moves(0), cur(0), refutation_index(0), n_bad_captures(0), bad_capture_index(0)
+{
+	packed_tt_move = tt_pack_move(tt_move);
+
+	if (killers) {
+		refutations[0] = killers[0];
+		refutations[1] = killers[1];
+	}
+
+	refutations[2] = countermove;
+
+	for(int i=0; i<3; i++)
+		packed_refutations[i] = 0;
+}
+
+int move_picker::score_capture(const libchess::Move move) const
+{
+	auto piece_from = pos.piece_on(move.from_square());
+
+	int score = 0;
+
+	if (pos.is_promotion_move(move))
+		score += eval_piece(*move.promotion_piece_type(), pars) << 18;
+
+	if (pos.is_capture_move(move)) {
+		auto piece_to = pos.piece_on(move.to_square());
+
+		libchess::PieceType victim = move.type() == libchess::Move::Type::ENPASSANT ? libchess::constants::PAWN : piece_to->type();
+
+		score += eval_piece(victim, pars) << 18;
+
+		if (piece_from->type() != libchess::constants::KING)
+			score += (pars.tune_queen.value() - eval_piece(piece_from->type(), pars)) << 8;
+
+		if (hist)
+			score += hist->capture_score(*piece_from, move, victim) * 4;
+	}
+
+	score += -psq(move.from_square(), piece_from->color(), piece_from->type(), 0) + psq(move.to_square(), piece_from->color(), piece_from->type(), 0);
+
+	return score;
+}
+
+int move_picker::score_quiet(const libchess::Move move) const
+{
+	auto piece_from = pos.piece_on(move.from_square());
+
+	int score = hist ? hist->quiet_score(pos.side_to_move(), *piece_from, move, cont1, cont2) : 0;
+
+	score += -psq(move.from_square(), piece_from->color(), piece_from->type(), 0) + psq(move.to_square(), piece_from->color(), piece_from->type(), 0);
+
+	return score;
+}
+
+libchess::MoveList & move_picker::start_generating()
+{
+	buffer->generated.values().clear();  // keeps the reserved space
+
+	return buffer->generated;
+}
+
+void move_picker::add_moves(const bool quiet)
+{
+	libchess::Move *const moves = buffer->moves;
+	int *const scores = buffer->scores;
+
+	for(const auto move : buffer->generated) {
+		uint16_t packed = tt_pack_move(move);
+
+		if (packed == packed_tt_move || n_moves >= MP_MAX_MOVES)
+			continue;
+
+		if (quiet && (packed == packed_refutations[0] || packed == packed_refutations[1] || packed == packed_refutations[2]))
+			continue;
+
+		moves[n_moves] = move;
+
+		if (quiet)
+			scores[n_moves] = score_quiet(move);
+		else
+			scores[n_moves] = pos.is_capture_move(move) || pos.is_promotion_move(move) ? score_capture(move) : score_quiet(move);
+
+		n_moves++;
+	}
+}
+
+// selection sort step: moves the best remaining one to the front
+bool move_picker::pick_best(libchess::Move *const move)
+{
+	if (cur >= n_moves)
+		return false;
+
+	libchess::Move *const moves = buffer->moves;
+	int *const scores = buffer->scores;
+
+	int best = cur;
+
+	for(int i=cur + 1; i<n_moves; i++) {
+		if (scores[i] > scores[best])
+			best = i;
+	}
+
+	std::swap(moves[cur], moves[best]);
+	std::swap(scores[cur], scores[best]);
+
+	*move = moves[cur++];
+
+	return true;
+}
+
+bool move_picker::next(libchess::Move *const move)
+{
+	libchess::Color side = pos.side_to_move();
+
+	for(;;) {
+		switch(stage) {
+			case MP_STAGE_TT:
+				stage = lg.checkers ? MP_STAGE_GEN_EVASIONS : MP_STAGE_GEN_CAPTURES;
+
+				if (tt_move.value()) {
+					kind = MP_KIND_TT;
+					*move = tt_move;
+					return true;
+				}
+				break;
+
+			case MP_STAGE_GEN_CAPTURES: {
+				libchess::MoveList & ml = start_generating();
+				pos.generate_promotions(ml, side);
+				pos.generate_capture_moves(ml, side);
+
+				add_moves(false);
+
+				stage = MP_STAGE_CAPTURES;
+				break;
+			}
+
+			case MP_STAGE_CAPTURES:
+				if (pick_best(move)) {
+					if (!is_legal_move(pos, lg, *move))
+						break;
+
+					// losing captures are tried after the quiet moves
+					if (pos.is_capture_move(*move) && see(pos, *move, pars) < 0) {
+						if (!captures_only)
+							buffer->bad_captures[n_bad_captures++] = *move;
+
+						break;
+					}
+
+					kind = MP_KIND_CAPTURE;
+					return true;
+				}
+
+				stage = captures_only ? MP_STAGE_DONE : MP_STAGE_REFUTATIONS;
+				break;
+
+			case MP_STAGE_REFUTATIONS:
+				while(refutation_index < 3) {
+					int index = refutation_index++;
+
+					if (refutations[index].value() == 0)
+						continue;
+
+					uint16_t packed = tt_pack_move(refutations[index]);
+
+					if (packed == packed_tt_move || packed == packed_refutations[0] || packed == packed_refutations[1])
+						continue;
+
+					// only quiet moves that are legal here
+					libchess::Move refutation = unpack_move(pos, packed);
+
+					if (refutation.value() == 0 || pos.is_capture_move(refutation) || pos.is_promotion_move(refutation))
+						continue;
+
+					packed_refutations[index] = packed;
+
+					kind = index < 2 ? MP_KIND_KILLER : MP_KIND_COUNTERMOVE;
+					*move = refutation;
+					return true;
+				}
+
+				stage = MP_STAGE_GEN_QUIETS;
+				break;
+
+			case MP_STAGE_GEN_QUIETS: {
+				libchess::MoveList & ml = start_generating();
+				pos.generate_quiet_moves(ml, side);
+
+				n_moves = cur = 0;
+				add_moves(true);
+
+				stage = MP_STAGE_QUIETS;
+				break;
+			}
+
+			case MP_STAGE_QUIETS:
+				if (pick_best(move)) {
+					if (!is_legal_move(pos, lg, *move))
+						break;
+
+					kind = MP_KIND_QUIET;
+					return true;
+				}
+
+				stage = MP_STAGE_BAD_CAPTURES;
+				break;
+
+			case MP_STAGE_BAD_CAPTURES:
+				if (bad_capture_index < n_bad_captures) {
+					kind = MP_KIND_BAD_CAPTURE;
+					*move = buffer->bad_captures[bad_capture_index++];
+					return true;
+				}
+
+				stage = MP_STAGE_DONE;
+				break;
+
+			case MP_STAGE_GEN_EVASIONS: {
+				libchess::MoveList & ml = start_generating();
+				generate_evasions(pos, lg, ml);
+
+				add_moves(false);
+
+				stage = MP_STAGE_EVASIONS;
+				break;
+			}
+
+			case MP_STAGE_EVASIONS:
+				if (pick_best(move)) {
+					kind = MP_KIND_EVASION;
+					return true;
+				}
+
+				stage = MP_STAGE_DONE;
+				break;
+
+			case MP_STAGE_DONE:
+				return false;
+		}
+	}
+}
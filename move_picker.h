@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include "libchess/Position.h"
+#include "eval_par.h"
+#include "history.h"
+#include "legality.h"
+
+#define MP_MAX_MOVES 256
+#define MP_MAX_BAD_CAPTURES MP_MAX_MOVES  // all captures could be losing ones
+
+typedef enum { MP_STAGE_TT, MP_STAGE_GEN_CAPTURES, MP_STAGE_CAPTURES, MP_STAGE_REFUTATIONS, MP_STAGE_GEN_QUIETS, MP_STAGE_QUIETS, MP_STAGE_BAD_CAPTURES, MP_STAGE_GEN_EVASIONS, MP_STAGE_EVASIONS, MP_STAGE_DONE } mp_stage_t;
+
+// storage of the move picker; one per ply in the search stack so that
+// picking moves does not allocate
+typedef struct
+{
+	libchess::MoveList generated;  // reserved for MP_MAX_MOVES by move_buffer_init()
+	libchess::Move moves[MP_MAX_MOVES];
+	int scores[MP_MAX_MOVES];
+
+	libchess::Move bad_captures[MP_MAX_BAD_CAPTURES];
+} move_buffer_t;
+
+void move_buffer_init(move_buffer_t *const buffer);
+
+// which stage produced a move; used for the beta cut-off statistics
+typedef enum { MP_KIND_TT, MP_KIND_CAPTURE, MP_KIND_KILLER, MP_KIND_COUNTERMOVE, MP_KIND_QUIET, MP_KIND_BAD_CAPTURE, MP_KIND_EVASION, MP_N_KINDS } mp_kind_t;
+
+// produces the legal moves of a position in stages: the tt move
+// without generating anything, then captures and promotions, the two killers
+// and the countermove (checked with unpack_move(), so also without
+// generating), the quiet moves and finally the captures that lose material
+// according to see(); qs does not get those at all. moves of a stage are scored once when generated and
+// then selected one by one, so a cut-off early in a stage does not pay for
+// sorting the rest. when in check all evasions are generated at once.
+// the generated moves are pseudo legal and are checked against the pins and
+// checkers in "lg" when they are picked.
+class move_picker
+{
+private:
+	libchess::Position & pos;
+	const legality_t & lg;
+	const eval_par & pars;
+	const history *const hist;  // nullptr: no history ordering
+	const continuation_history_t *const cont1, *const cont2;
+	const libchess::Move tt_move;
+	libchess::Move refutations[3];  // killers, countermove
+	uint16_t packed_tt_move, packed_refutations[3];  // the ones played, for skipping them in the later stages
+	const bool captures_only;  // qs
+
+	mp_stage_t stage;
+	mp_kind_t kind;
+
+	move_buffer_t *const buffer;
+	int n_moves, cur, refutation_index, n_bad_captures, bad_capture_index;
+
+	libchess::MoveList & start_generating();
+	void add_moves(const bool quiet);
+	int score_capture(const libchess::Move move) const;
+	int score_quiet(const libchess::Move move) const;
+	bool pick_best(libchess::Move *const move);
+
+public:
+	move_picker(libchess::Position & pos, const legality_t & lg, const eval_par & pars, const history *const hist, const continuation_history_t *const cont1, const continuation_history_t *const cont2, const libchess::Move tt_move, const libchess::Move *const killers, const libchess::Move countermove, const bool captures_only, move_buffer_t *const buffer);
+
+	// false when there are no moves left
+	bool next(libchess::Move *const move);
+
+	mp_kind_t get_kind() const { return kind; }
+	bool quiets_generated() const { return stage >= MP_STAGE_QUIETS; }
+};
@@ -0,0 +1,38 @@
+#include <cstdint>
+
+#include "pawn_hash.h"
+
+pawn_hash::pawn_hash(const uint64_t n_entries) : n_entries(n_entries), n_lookups(0), n_hits(0)
+{
+	entries = new pawn_entry_t[n_entries];
+
+	// pawns can never be on all squares: marks the slot as empty
+	for(uint64_t i=0; i<n_entries; i++)
+		entries[i].white_pawns = entries[i].black_pawns = ~0ull;
+}
+
+pawn_hash::~pawn_hash()
+{
+	delete [] entries;
+}
+
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdll;
+	x ^= x >> 33;
+
+	return x;
+}
+
+pawn_entry_t *pawn_hash::lookup(const uint64_t white_pawns, const uint64_t black_pawns, bool *const hit)
+{
+	pawn_entry_t *const e = &entries[(mix(white_pawns) ^ mix(black_pawns * 0x9e3779b97f4a7c15ll)) & (n_entries - 1)];
+
+	*hit = e->white_pawns == white_pawns && e->black_pawns == black_pawns;
+
+	n_lookups++;
+	n_hits += *hit;
+
+	return e;
+}
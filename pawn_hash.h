@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+typedef struct
+{
+	uint64_t white_pawns, black_pawns;  // the key: verified in full so no collisions
+
+	int32_t score;  // pawn structure terms, from white's point of view
+	uint8_t files_without_pawns[2];  // per color: bit x set if file x has no pawn
+	int8_t shield_king_square;  // white king square the shield was computed for, -1 if not
+	int8_t shield;  // king_shield(white) - king_shield(black)
+} pawn_entry_t;
+
+// per thread cache of the pawn structure evaluation, only valid for the
+// parameter set that filled it
+class pawn_hash
+{
+private:
+	pawn_entry_t *entries;
+	uint64_t n_entries;  // power of 2
+
+	uint64_t n_lookups, n_hits;
+
+public:
+	pawn_hash(const uint64_t n_entries);
+	~pawn_hash();
+
+	// returns the slot for these pawns; *hit tells if it holds them already
+	pawn_entry_t *lookup(const uint64_t white_pawns, const uint64_t black_pawns, bool *const hit);
+
+	uint64_t get_lookups() const { return n_lookups; }
+	uint64_t get_hits() const { return n_hits; }
+};
@@ -2,6 +2,7 @@
 #include <map>
 
 #include "libchess/Position.h"
+#include "psq.h"
 #include "utils.h"
 
 // taken from dorpsgek
@@ -151,3 +152,11 @@ int psq(libchess::Square sq, libchess::Color c, libchess::PieceType t, int phase
 
 	return (idx[0][t][index] * (255 - phase) + idx[1][t][index] * phase) / 256;
 }
+
+int32_t psq_packed(libchess::Square sq, libchess::Color c, libchess::PieceType t)
+{
+	const int pos = sq;
+	const int index = c == libchess::constants::WHITE ? pos : (pos ^ 56);
+
+	return psq_pack(idx[0][t][index], idx[1][t][index]);
+}
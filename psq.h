@@ -1,3 +1,13 @@
+#pragma once
+
 #include "libchess/Position.h"
 
 int psq(libchess::Square sq, libchess::Color c, libchess::PieceType t, int phase);
+
+// mg and eg value in one word (mg in the upper 16 bits) so that both are
+// summed with one addition
+inline int32_t psq_pack(const int mg, const int eg) { return int32_t(uint32_t(mg) << 16) + eg; }
+inline int psq_mg(const int32_t s) { return int16_t(uint16_t((uint32_t(s) + 0x8000) >> 16)); }
+inline int psq_eg(const int32_t s) { return int16_t(uint16_t(uint32_t(s))); }
+
+int32_t psq_packed(libchess::Square sq, libchess::Color c, libchess::PieceType t);
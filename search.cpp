@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <climits>
+#include <cmath>
 #include <condition_variable>
 #include <cstring>
 #include <map>
@@ -12,125 +14,391 @@
 #include "Fathom/src/tbprobe.h"
 #include "eval_par.h"
 #include "eval.h"
+#include "cuckoo.h"
+#include "legality.h"
 #include "psq.h"
+#include "see.h"
 #include "tt.h"
 #include "utils.h"
 #include "search.h"
 #include "utils.h"
 
 #define WITH_LMR
+#define WITH_PVS
+#define WITH_COUNTERMOVES
+#define WITH_SEE_PRUNING
+#define WITH_FUTILITY
+#define WITH_LMP
+#define WITH_RAZORING
+#define WITH_DELTA_PRUNING
+#define WITH_QS_TT
+
+#define SEE_PRUNING_DEPTH 3
+#define FUTILITY_DEPTH 3
+#define LMP_DEPTH 4
+#define RAZORING_DEPTH 2
+
+// LMR: reduction in plies for [depth][move number]
+static int lmr_reductions[64][64];
+
+void init_search()
+{
+	for(int d=1; d<64; d++) {
+		for(int n=1; n<64; n++)
+			lmr_reductions[d][n] = int(0.5 + log(d) * log(n) / 2.0);
+	}
+
+	init_cuckoo();
+}
 
-class sort_movelist_compare
+bool is_check(libchess::Position & pos)
 {
-private:
-        meta_t *const meta;
-        libchess::Position *const p;
-        const eval_par & pars;
-        std::vector<libchess::Move> first_moves;
-        std::optional<libchess::Square> previous_move_target;
-
-public:
-        sort_movelist_compare(meta_t *const meta, libchess::Position *const p, const eval_par & pars) : meta(meta), p(p), pars(pars) {
-                if (p->previous_move())
-                        previous_move_target = p->previous_move()->to_square();
-        }
-
-        void add_first_move(const libchess::Move move) {
-                if (move.value())
-                        first_moves.push_back(move);
-        }
-
-        int move_evaluater(const libchess::Move move) const {
-                for(int i=0; i<first_moves.size(); i++) {
-                        if (move == first_moves.at(i))
-                                return INT_MAX - i;
-                }
+	return pos.attackers_to(pos.piece_type_bb(libchess::constants::KING, !pos.side_to_move()).forward_bitscan(), pos.side_to_move());
+}
 
-                auto piece_from = p->piece_on(move.from_square());
+// the history tables of each search thread, kept between searches
+static std::vector<history *> histories;
+static std::mutex histories_lock;
 
-                int score = 0;
+static history *get_history(const int thread_nr)
+{
+	std::unique_lock<std::mutex> lck(histories_lock);
 
-                if (p->is_promotion_move(move))
-                        score += eval_piece(*move.promotion_piece_type(), pars) << 18;
+	while(histories.size() <= size_t(thread_nr))
+		histories.push_back(new history());
 
-                if (p->is_capture_move(move)) {
-                        auto piece_to = p->piece_on(move.to_square());
+	return histories.at(thread_nr);
+}
 
-                        // victim
-                        score += (move.type() == libchess::Move::Type::ENPASSANT ? pars.tune_pawn.value() : eval_piece(piece_to->type(), pars)) << 18;
+// the search state (stack, killers, countermoves, pawn hash, eval cache) of
+// each search thread: large and with reserved move buffers, so it is only
+// set up once
+static std::vector<meta_t *> metas;
 
-                        if (piece_from->type() != libchess::constants::KING)
-                                score += (pars.tune_queen.value() - eval_piece(piece_from->type(), pars)) << 8;
+static meta_t *get_meta(const int thread_nr)
+{
+	std::unique_lock<std::mutex> lck(histories_lock);
 
-//                      if (move.to_square() == previous_move_target)
-//                              score += 100 << 8;
-                }
-                else {
-                        score += meta -> hbt[p->side_to_move()][move.from_square()][move.to_square()] << 8;
-                }
+	while(metas.size() <= size_t(thread_nr)) {
+		meta_t *meta = new meta_t();
+		init_search_stack(meta);
+
+		// both only depend on the position and default_parameters
+		meta->ph = new pawn_hash(PAWN_HASH_ENTRIES);
+		meta->ec = new eval_cache(EVAL_CACHE_ENTRIES);
 
-                score += -psq(move.from_square(), piece_from->color(), piece_from->type(), 0) + psq(move.to_square(), piece_from->color(), piece_from->type(), 0);
+		metas.push_back(meta);
+	}
 
-                return score;
-        }
-};
+	return metas.at(thread_nr);
+}
 
-void sort_movelist(libchess::Position & pos, libchess::MoveList & move_list, sort_movelist_compare & smc)
+static void clear_refutations(meta_t *const meta)
 {
-	move_list.sort([&smc](const libchess::Move move) { return smc.move_evaluater(move); });
+	for(int i=0; i<MAX_PLY; i++)
+		meta->stack[i].killers[0] = meta->stack[i].killers[1] = libchess::Move();
+
+	std::fill(&meta->countermoves[0][0][0], &meta->countermoves[0][0][0] + sizeof(meta->countermoves) / sizeof(libchess::Move), libchess::Move());
 }
 
-bool is_check(libchess::Position & pos)
+// for a new game
+void clear_history()
 {
-	return pos.attackers_to(pos.piece_type_bb(libchess::constants::KING, !pos.side_to_move()).forward_bitscan(), pos.side_to_move());
+	std::unique_lock<std::mutex> lck(histories_lock);
+
+	for(auto & h : histories)
+		h->clear();
+
+	for(auto & meta : metas)
+		clear_refutations(meta);
 }
 
-libchess::MoveList gen_qs_moves(libchess::Position & pos)
+void init_search_stack(meta_t *const meta)
 {
-	libchess::Color side = pos.side_to_move();
+	for(int i=0; i<MAX_PLY; i++)
+		move_buffer_init(&meta->stack[i].move_buffer);
+
+	clear_refutations(meta);
 
-	if (pos.checkers_to(side))
-		return pos.pseudo_legal_move_list();
+	meta->n_game_keys = 0;
+}
 
-	libchess::MoveList ml;
-	pos.generate_promotions(ml, side);
-	pos.generate_capture_moves(ml, side);
+void collect_game_keys(meta_t *const meta, const libchess::Position & pos)
+{
+	libchess::Position game = pos;
 
-	return ml;
+	meta->n_game_keys = 0;
+
+	while(meta->n_game_keys < std::min(pos.halfmoves(), MAX_GAME_KEYS) && game.previous_move()) {
+		game.unmake_move();
+		meta->game_keys[meta->n_game_keys++] = game.hash();
+	}
 }
 
-bool is_insufficient_material_draw(const libchess::Position & pos)
+void reset_search_stack(meta_t *const meta, const libchess::Position & pos)
 {
-	if (pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::WHITE).popcount() || 
-		pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::BLACK).popcount() ||
-		pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::WHITE).popcount() ||
-		pos.piece_type_bb(libchess::constants::ROOK, libchess::constants::BLACK).popcount() ||
-		pos.piece_type_bb(libchess::constants::QUEEN, libchess::constants::WHITE).popcount() ||
-		pos.piece_type_bb(libchess::constants::QUEEN, libchess::constants::BLACK).popcount())
-		return false;
-
-	if (pos.piece_type_bb(libchess::constants::KNIGHT, libchess::constants::WHITE).popcount() || 
-		pos.piece_type_bb(libchess::constants::KNIGHT, libchess::constants::BLACK).popcount() ||
-		pos.piece_type_bb(libchess::constants::BISHOP, libchess::constants::WHITE).popcount() ||
-		pos.piece_type_bb(libchess::constants::BISHOP, libchess::constants::BLACK).popcount())
-		return false;
-
-	return true;
+	meta->ply = 0;
+
+	material_init(&meta->stack[0].material, pos);
+
+	meta->stack[0].key = pos.hash();
+	meta->stack[0].reversible = meta->n_game_keys;
 }
 
-int qs(libchess::Position & pos, int alpha, int beta, meta_t *meta, int qsdepth, libchess::Move *m, eval_par & pars)
+void do_move(libchess::Position & pos, meta_t *const meta, const libchess::Move move)
+{
+	search_frame_t & next = meta->stack[meta->ply + 1];
+
+	next.material = meta->stack[meta->ply].material;
+	material_update(&next.material, pos, move);
+
+	meta->stack[meta->ply].move = move;
+	meta->stack[meta->ply].continuation = meta->hist ? meta->hist->get_continuation(*pos.piece_on(move.from_square()), move) : nullptr;
+
+	pos.make_move(move);
+
+	next.key = pos.hash();
+	next.reversible = std::min(pos.halfmoves(), meta->stack[meta->ply].reversible + 1);
+
+	meta->ply++;
+}
+
+void do_null_move(libchess::Position & pos, meta_t *const meta)
+{
+	meta->stack[meta->ply + 1].material = meta->stack[meta->ply].material;
+
+	meta->stack[meta->ply].move = libchess::Move();
+	meta->stack[meta->ply].continuation = nullptr;
+
+	pos.make_null_move();
+
+	// positions on both sides of a null move are no repetition
+	meta->stack[meta->ply + 1].key = pos.hash();
+	meta->stack[meta->ply + 1].reversible = 0;
+
+	meta->ply++;
+}
+
+// did this position occur before? (a 2-fold repetition counts as a draw)
+static bool is_repetition(const meta_t *const meta)
+{
+	const search_frame_t & cur = meta->stack[meta->ply];
+
+	// the side to move must be the same, and it takes at least 4 plies
+	for(int i=4; i<=cur.reversible; i+=2) {
+		int index = meta->ply - i;
+		uint64_t key = index >= 0 ? meta->stack[index].key : meta->game_keys[-index - 1];
+
+		if (key == cur.key)
+			return true;
+	}
+
+	return false;
+}
+
+// can the side to move go back to a position of the search with one
+// reversible move? then it can at least get a draw. cycles that start
+// before the root are not looked at, these need a repetition more.
+static bool has_upcoming_repetition(const libchess::Position & pos, const meta_t *const meta)
+{
+	const search_frame_t & cur = meta->stack[meta->ply];
+	const libchess::Bitboard occupancy = pos.occupancy_bb();
+
+	int end = std::min(cur.reversible, meta->ply - 1);
+
+	for(int i=3; i<=end; i+=2) {
+		libchess::Square from, to;
+
+		if (cuckoo_lookup(cur.key ^ meta->stack[meta->ply - i].key, &from, &to) && !(libchess::lookups::intervening(from, to) & occupancy))
+			return true;
+	}
+
+	return false;
+}
+
+void undo_move(libchess::Position & pos, meta_t *const meta)
 {
+	pos.unmake_move();
+
+	meta->ply--;
+}
+
+// the countermove table entry for the move that led to this position
+static libchess::Move *countermove_entry(libchess::Position & pos, meta_t *const meta)
+{
+	libchess::Move previous;
+
+	if (meta->ply > 0)
+		previous = meta->stack[meta->ply - 1].move;
+	else if (pos.previous_move())
+		previous = *pos.previous_move();
+
+	if (previous.value() == 0)  // also after a null move
+		return nullptr;
+
+	auto piece = pos.piece_on(previous.to_square());
+	if (!piece.has_value())
+		return nullptr;
+
+	return &meta->countermoves[piece->color()][piece->type()][previous.to_square()];
+}
+
+// continuation history of the move played "plies_back" plies ago
+static continuation_history_t *previous_continuation(meta_t *const meta, const int plies_back)
+{
+	int ply = meta->ply - plies_back;
+
+	return ply >= 0 ? meta->stack[ply].continuation : nullptr;
+}
+
+// "move" gave a beta cut-off: bonus for it, malus for the moves of the same
+// kind that were searched before it
+static void update_histories(libchess::Position & pos, meta_t *const meta, const libchess::Move move, const int depth)
+{
+	history *const hist = meta->hist;
+	const search_frame_t & frame = meta->stack[meta->ply];
+
+	const libchess::Color side = pos.side_to_move();
+	const int bonus = history_bonus(depth);
+
+	if (pos.is_capture_move(move)) {
+		libchess::PieceType victim = move.type() == libchess::Move::Type::ENPASSANT ? libchess::constants::PAWN : pos.piece_on(move.to_square())->type();
+
+		hist->update_capture(*pos.piece_on(move.from_square()), move, victim, bonus);
+	}
+	else if (!pos.is_promotion_move(move)) {
+		continuation_history_t *const cont1 = previous_continuation(meta, 1);
+		continuation_history_t *const cont2 = previous_continuation(meta, 2);
+
+		hist->update_quiet(side, *pos.piece_on(move.from_square()), move, cont1, cont2, bonus);
+
+		for(int i=0; i<frame.n_quiets_tried; i++) {
+			libchess::Move other = frame.quiets_tried[i];
+
+			if (other != move)
+				hist->update_quiet(side, *pos.piece_on(other.from_square()), other, cont1, cont2, -bonus);
+		}
+	}
+
+	for(int i=0; i<frame.n_captures_tried; i++) {
+		libchess::Move other = frame.captures_tried[i];
+
+		if (other == move)
+			continue;
+
+		libchess::PieceType victim = other.type() == libchess::Move::Type::ENPASSANT ? libchess::constants::PAWN : pos.piece_on(other.to_square())->type();
+
+		hist->update_capture(*pos.piece_on(other.from_square()), other, victim, -bonus);
+	}
+}
+
+// eval() through the per thread cache: evaluates every position once
+int evaluate(libchess::Position & pos, meta_t *const meta, const eval_par & pars)
+{
+	const material_state_t *ms = &meta->stack[meta->ply].material;
+
+	if (!meta->ec)
+		return eval(pos, pars, meta->ph, ms);
+
+	const uint64_t hash = pos.hash();
+	int score = 0;
+
+	if (meta->ec->lookup(hash, &score))
+		return score;
+
+	score = eval(pos, pars, meta->ph, ms);
+
+	meta->ec->store(hash, score);
+
+	return score;
+}
+
+// this ply's move followed by the pv of the reply (that was just searched)
+static void update_pv(meta_t *const meta, const libchess::Move move)
+{
+	search_frame_t & cur = meta->stack[meta->ply];
+	const search_frame_t & next = meta->stack[meta->ply + 1];
+
+	cur.pv[0] = move;
+	std::copy(next.pv, next.pv + next.pv_length, cur.pv + 1);
+	cur.pv_length = next.pv_length + 1;
+}
+
+// "tuning": evaluate with "pars" (the tuner) instead of default_parameters
+template<node_type_t nt, bool tuning>
+static int qs(libchess::Position & pos, int alpha, int beta, meta_t *meta, int qsdepth, libchess::Move *m, const eval_par & tuning_pars)
+{
+	constexpr bool pv_node = nt != NT_NONPV;
+
+	const eval_par & pars = tuning ? tuning_pars : default_parameters;
+
 	int best_score = -32767;
 
+	meta->stack[meta->ply].pv_length = 0;
+
 	meta->node_count++;
 
-	if (pos.halfmoves() >= 100 || pos.is_repeat() || is_insufficient_material_draw(pos))
+	if (pos.halfmoves() >= 100 || is_repetition(meta) || material_is_draw(meta->stack[meta->ply].material))
 		return 0;
 
+	if (alpha < 0 && has_upcoming_repetition(pos, meta)) {
+		alpha = 0;
+
+		if (alpha >= beta)
+			return alpha;
+	}
+
 	bool in_check = pos.in_check();
 
+	if (meta->ply >= MAX_PLY - 1)
+		return in_check ? 0 : evaluate(pos, meta, pars);
+
+	meta->stack[meta->ply].static_eval = -32767;
+
+	libchess::Move tt_move;
+
+	// TT (not while tuning: entries depend on the parameters) //
+#ifdef WITH_QS_TT
+	const int start_alpha = alpha;
+	uint64_t hash = pos.hash();
+
+	if (!tuning) {
+		meta->tt_stats.probes[TT_QS_DEPTH]++;
+
+		std::optional<tt_entry> te = meta->tti->lookup(hash);
+
+		if (te.has_value()) {
+			meta->tt_stats.hits[TT_QS_DEPTH]++;
+
+			tt_move = unpack_move(pos, te.value().data_._data.m);
+
+			bool tt_move_valid = te.value().data_._data.m == 0 || tt_move.value();
+			int score = te.value().data_._data.score;
+
+			// mate scores depend on the distance to the root; not stored by qs
+			if (tt_move_valid && abs(score) <= 9800) {
+				auto flags = te.value().data_._data.flags;
+
+				if (flags == EXACT || (flags == LOWERBOUND && score >= beta) || (flags == UPPERBOUND && score <= alpha)) {
+					meta->tt_stats.cutoffs[TT_QS_DEPTH]++;
+
+					*m = tt_move;
+
+					return score;
+				}
+			}
+
+			// only a move that qs() itself would search
+			if (tt_move.value() && !in_check && !pos.is_capture_move(tt_move) && !pos.is_promotion_move(tt_move))
+				tt_move = libchess::Move();
+		}
+	}
+#endif
+	////////
+
 	if (!in_check) {
-		best_score = eval(pos, pars);
+		best_score = evaluate(pos, meta, pars);
+		meta->stack[meta->ply].static_eval = best_score;
 
 		if (best_score > alpha && best_score >= beta)
 			return best_score;
@@ -146,52 +414,62 @@ int qs(libchess::Position & pos, int alpha, int beta, meta_t *meta, int qsdepth,
 			alpha = best_score;
 	}
 
-	auto move_list = gen_qs_moves(pos);
-	int n_played = 0;
+	legality_t lg;
+	legality_init(&lg, pos);
 
-	sort_movelist_compare smc(meta, &pos, pars);
-	sort_movelist(pos, move_list, smc);
+	move_picker mp(pos, lg, pars, meta->hist, previous_continuation(meta, 1), previous_continuation(meta, 2), tt_move, nullptr, libchess::Move(), true, &meta->stack[meta->ply].move_buffer);
+	libchess::Move move;
+	libchess::Move best_move;
+	int n_played = 0;
 
-	for(const auto move : move_list) {
+	while(mp.next(&move)) {
 		if (meta->ei->flag)
 			break;
 
-		if (!in_check && pos.is_capture_move(move)) {
-			auto piece_to = pos.piece_on(move.to_square());
-			int eval_target = move.type() == libchess::Move::Type::ENPASSANT ? pars.tune_pawn.value() : eval_piece(piece_to->type(), pars);
+		// (captures that lose material according to see() are not produced
+		// by the move picker in qs)
 
-			auto piece_from = pos.piece_on(move.from_square());
-			int eval_killer = eval_piece(piece_from->type(), pars);
+#ifdef WITH_DELTA_PRUNING
+		// even winning the captured piece does not bring the score near alpha
+		if (!in_check && !pos.is_promotion_move(move)) {
+			auto victim = pos.piece_on(move.to_square());
+			int gain = victim.has_value() ? eval_piece(victim->type(), pars) : eval_piece(libchess::constants::PAWN, pars);  // no piece: en passant
 
-			if (eval_killer > eval_target && pos.attackers_to(move.to_square(), piece_to->color()))
+			if (meta->stack[meta->ply].static_eval + gain + pars.tune_pawn.value() * 2 <= alpha)
 				continue;
 		}
+#endif
 
 		libchess::Move curm{0};
 
-		pos.make_move(move);
-
-		if (pos.attackers_to(pos.piece_type_bb(libchess::constants::KING, !pos.side_to_move()).forward_bitscan(), pos.side_to_move())) {
-			pos.unmake_move();
-			continue;
-		}
+		do_move(pos, meta, move);
+#ifdef WITH_QS_TT
+		if (!tuning)
+			meta->tti->prefetch(pos.hash());
+#endif
 
 		n_played++;
 
-		int score = -qs(pos, -beta, -alpha, meta, qsdepth + 1, &curm);
+		int score = -qs<nt, tuning>(pos, -beta, -alpha, meta, qsdepth + 1, &curm, tuning_pars);
 
-		pos.unmake_move();
+		undo_move(pos, meta);
 
 		if (score > best_score) {
 			best_score = score;
 			*m = move;
+			best_move = move;
 
 			if (score > alpha) {
 				alpha = score;
 
+				if (pv_node)
+					update_pv(meta, move);
+
 				if (score >= beta) {
 					meta->bco_1st_move += n_played == 1;
 					meta->bco_total++;
+					meta->bco_stage[mp.get_kind()]++;
+					meta->bco_before_quiets += !mp.quiets_generated();
 					break;
 				}
 			}
@@ -202,44 +480,84 @@ int qs(libchess::Position & pos, int alpha, int beta, meta_t *meta, int qsdepth,
 		if (in_check)
 			best_score = -10000 + meta->max_depth + qsdepth;
 		else if (best_score == -32767)
-			best_score = eval(pos, pars);
+			best_score = evaluate(pos, meta, pars);
 	}
 
+#ifdef WITH_QS_TT
+	if (!tuning && !meta->ei->flag && abs(best_score) <= 9800) {
+		tt_entry_flag flag = EXACT;
+
+		if (best_score <= start_alpha)
+			flag = UPPERBOUND;
+		else if (best_score >= beta)
+			flag = LOWERBOUND;
+
+		meta->tti->store(hash, flag, TT_QS_DEPTH, best_score, best_move.value() ? best_move : tt_move);
+	}
+#endif
+
 	return best_score;
 }
 
-int search(libchess::Position & pos, int depth, int alpha, int beta, bool is_null_move, meta_t *meta, libchess::Move *const m)
+int qs(libchess::Position & pos, int alpha, int beta, meta_t *meta, int qsdepth, libchess::Move *m, eval_par & pars)
 {
+	if (&pars == &default_parameters)
+		return qs<NT_PV, false>(pos, alpha, beta, meta, qsdepth, m, pars);
+
+	return qs<NT_PV, true>(pos, alpha, beta, meta, qsdepth, m, pars);
+}
+
+template<node_type_t nt>
+static int search(libchess::Position & pos, int depth, int alpha, int beta, bool is_null_move, meta_t *meta, libchess::Move *const m)
+{
+	constexpr bool is_root_position = nt == NT_ROOT;
+	constexpr bool pv_node = nt != NT_NONPV;
+	// type of the first child (and of all children without WITH_PVS)
+	constexpr node_type_t child_nt = pv_node ? NT_PV : NT_NONPV;
+
 	if (depth == 0)
-		return qs(pos, alpha, beta, meta, 0, m);
+		return qs<child_nt, false>(pos, alpha, beta, meta, 0, m, default_parameters);
 
-	meta->node_count++;
+	meta->stack[meta->ply].pv_length = 0;
 
-	const int start_alpha = alpha;
+	meta->node_count++;
 
-	bool is_root_position = meta->max_depth == depth;
 	bool in_check = pos.in_check();
 
-	if (!is_root_position && (pos.halfmoves() >= 100 || pos.is_repeat() || is_insufficient_material_draw(pos)))
+	if (!is_root_position && (pos.halfmoves() >= 100 || is_repetition(meta) || material_is_draw(meta->stack[meta->ply].material)))
 		return 0;
 
-	libchess::MoveList move_list;
-	bool move_list_set = false;
+	if (!is_root_position && alpha < 0 && has_upcoming_repetition(pos, meta)) {
+		alpha = 0;
+
+		if (alpha >= beta)
+			return alpha;
+	}
+
+	const int start_alpha = alpha;
+
+	if (meta->ply >= MAX_PLY - 1)
+		return in_check ? 0 : evaluate(pos, meta, default_parameters);
+
+	meta->stack[meta->ply].static_eval = -32767;
 
 	// TT //
 	libchess::Move tt_move;
 	uint64_t hash = pos.hash();
 	std::optional<tt_entry> te = meta->tti->lookup(hash);
 
+	const int stats_depth = std::min(depth, TT_STATS_DEPTH - 1);
+	meta->tt_stats.probes[stats_depth]++;
+
         if (te.has_value()) {
-		tt_move = libchess::Move(te.value().data_._data.m);
+		meta->tt_stats.hits[stats_depth]++;
+
+		tt_move = unpack_move(pos, te.value().data_._data.m);
 
-		move_list = pos.legal_move_list();
-		move_list_set = true;
+		// a move that is not valid here means that the (truncated) key collided
+		bool tt_move_valid = te.value().data_._data.m == 0 || tt_move.value();
 
-		if (tt_move.value() && !is_move_in_movelist(move_list, tt_move))
-			tt_move = libchess::Move();
-		else if (te.value().data_._data.depth >= depth) {
+		if (tt_move_valid && te.value().data_._data.depth >= depth) {
 			bool use = false;
 
 			int csd = meta->max_depth - depth;
@@ -254,17 +572,29 @@ int search(libchess::Position & pos, int depth, int alpha, int beta, bool is_nul
 				use = true;
 
 			if (use && (!is_root_position || tt_move.value())) {
+				meta->tt_stats.cutoffs[stats_depth]++;
+
 				*m = tt_move;
 
+				if (tt_move.value()) {
+					meta->stack[meta->ply].pv[0] = tt_move;
+					meta->stack[meta->ply].pv_length = 1;
+				}
+
 				return work_score;
 			}
 		}
 	}
 	////////
 
-	if (!is_root_position && depth <= 3 && beta <= 9800) {
-		int staticeval = eval(pos, default_parameters);
+	int staticeval = -32767;
 
+	if (!is_root_position && !in_check) {
+		staticeval = evaluate(pos, meta, default_parameters);
+		meta->stack[meta->ply].static_eval = staticeval;
+	}
+
+	if (!is_root_position && depth <= 3 && beta <= 9800) {
 		// static null pruning (reverse futility pruning)
 		if (depth == 1 && staticeval - default_parameters.tune_knight.value() > beta)
 			return beta;
@@ -276,20 +606,35 @@ int search(libchess::Position & pos, int depth, int alpha, int beta, bool is_nul
 			depth--;
 	}
 
+#ifdef WITH_RAZORING
+	// so far below alpha that only captures could help: let qs() decide
+	if (!pv_node && !in_check && depth <= RAZORING_DEPTH && alpha > -9800 &&
+			staticeval + default_parameters.tune_pawn.value() * (2 + 2 * depth) <= alpha) {
+		int razor_score = qs<NT_NONPV, false>(pos, alpha, alpha + 1, meta, 0, m, default_parameters);
+
+		if (razor_score <= alpha)
+			return razor_score;
+
+		// qs() used this frame too
+		meta->stack[meta->ply].pv_length = 0;
+	}
+#endif
+
 	int extension = in_check;
 
 	// null move //
 	int nm_reduce_depth = depth > 6 ? 4 : 3;
 	if (depth >= nm_reduce_depth && !in_check && !is_root_position && !is_null_move) {
-		pos.make_null_move();
+		do_null_move(pos, meta);
+		meta->tti->prefetch(pos.hash());
 
 		libchess::Move ignore;
-		int nmscore = -search(pos, depth - nm_reduce_depth, -beta, -beta + 1, true, meta, &ignore);
+		int nmscore = -search<NT_NONPV>(pos, depth - nm_reduce_depth, -beta, -beta + 1, true, meta, &ignore);
 
-		pos.unmake_move();
+		undo_move(pos, meta);
 
                 if (nmscore >= beta) {
-			int verification = search(pos, depth - nm_reduce_depth, beta - 1, beta, false, meta, &ignore);
+			int verification = search<NT_NONPV>(pos, depth - nm_reduce_depth, beta - 1, beta, false, meta, &ignore);
 
 			if (verification >= beta)
 				return beta;
@@ -300,66 +645,136 @@ int search(libchess::Position & pos, int depth, int alpha, int beta, bool is_nul
 	// IID //
 	libchess::Move iid_move;
 	if (!is_null_move && tt_move.value() == 0 && depth >= 2) {
-		if (abs(search(pos, depth - 2, alpha, beta, is_null_move, meta, &iid_move)) > 9800)
+		if (abs(search<child_nt>(pos, depth - 2, alpha, beta, is_null_move, meta, &iid_move)) > 9800)
 			extension |= 1;
 	}
 	/////////
 
-	if (!move_list_set)
-		move_list = pos.legal_move_list();
-
 	int best_score = -32767;
 	libchess::Move best_move;
 
-	sort_movelist_compare smc(meta, &pos, default_parameters);
-	smc.add_first_move(tt_move);
-	smc.add_first_move(iid_move);
-	sort_movelist(pos, move_list, smc);
+	// the iid and null move searches above used this frame too
+	meta->stack[meta->ply].pv_length = 0;
+
+	libchess::Move *const killers = meta->stack[meta->ply].killers;
+
+#ifdef WITH_COUNTERMOVES
+	libchess::Move *const countermove = countermove_entry(pos, meta);
+#else
+	libchess::Move *const countermove = nullptr;
+#endif
+
+	legality_t lg;
+	legality_init(&lg, pos);
+
+	move_picker mp(pos, lg, default_parameters, meta->hist, previous_continuation(meta, 1), previous_continuation(meta, 2), tt_move.value() ? tt_move : iid_move, killers, countermove ? *countermove : libchess::Move(), false, &meta->stack[meta->ply].move_buffer);
+	libchess::Move move;
 
 	int n_played = 0;
 
-	const size_t lmr_start = !in_check && depth >= 2 ? 4 : 999;
+	search_frame_t & frame = meta->stack[meta->ply];
+	frame.n_quiets_tried = frame.n_captures_tried = 0;
 
-	for(const libchess::Move move : move_list) {
+	// LMP: number of moves after which the remaining quiet moves are skipped
+	const int lmp_limit = 3 + depth * depth;
+
+	while(mp.next(&move)) {
 		if (meta->ei->flag)
 			break;
 
-		pos.make_move(move);
+#ifdef WITH_SEE_PRUNING
+		// near the leaves, skip quiet moves that put a piece en prise
+		if (!in_check && !is_root_position && depth <= SEE_PRUNING_DEPTH && n_played > 0 && best_score > -9800 &&
+				mp.get_kind() == MP_KIND_QUIET && see(pos, move, default_parameters) < -default_parameters.tune_pawn.value() * depth)
+			continue;
+#endif
+
+#if defined(WITH_FUTILITY) || defined(WITH_LMP)
+		if (!pv_node && !in_check && n_played > 0 && best_score > -9800 && mp.get_kind() == MP_KIND_QUIET) {
+			bool prune = false;
+#ifdef WITH_FUTILITY
+			// a quiet move will not make up for a static eval this far below alpha
+			prune |= depth <= FUTILITY_DEPTH && staticeval + default_parameters.tune_pawn.value() * (1 + 2 * depth) <= alpha;
+#endif
+#ifdef WITH_LMP
+			// late quiet moves of a well ordered list rarely cut off
+			prune |= depth <= LMP_DEPTH && n_played >= lmp_limit;
+#endif
+			// checking moves are searched anyway
+			if (prune && !gives_check(pos, move))
+				continue;
+		}
+#endif
+
+		const bool is_capture   = pos.is_capture_move(move);
+		const bool is_promotion = pos.is_promotion_move(move);
+
+		if (is_capture) {
+			if (frame.n_captures_tried < 32)
+				frame.captures_tried[frame.n_captures_tried++] = move;
+		}
+		else if (!is_promotion) {
+			if (frame.n_quiets_tried < 64)
+				frame.quiets_tried[frame.n_quiets_tried++] = move;
+		}
+
+		// a killer or countermove is expected to be good: no LMR
+		const bool is_refutation = mp.get_kind() == MP_KIND_KILLER || mp.get_kind() == MP_KIND_COUNTERMOVE;
+
+		do_move(pos, meta, move);
+		meta->tti->prefetch(pos.hash());
+
+		bool check_after_move = pos.in_check();
 
 		n_played++;
 
 		int score = 0;
 
+		libchess::Move curm;
+
+		// depth when not reduced; checking moves are not extended (as before)
+		int full_depth = check_after_move ? depth - 1 : depth - 1 + extension;
+		int new_depth = full_depth;
+
 #ifdef WITH_LMR
 		bool is_lmr = false;
-		int new_depth = depth - 1;
-		if (n_played >= lmr_start && !pos.is_capture_move(move) && !pos.is_promotion_move(move)) {
-			is_lmr = true;
-
-			if (n_played >= lmr_start + 2)
-				new_depth = (depth - 1) * 2 / 3;
-			else
-				new_depth = depth - 2;
-		}
+		if (!in_check && depth >= 2 && n_played > 1 && !check_after_move && !is_capture && !is_promotion && !is_refutation) {
+			int reduction = lmr_reductions[std::min(depth, 63)][std::min(n_played, 63)];
 
-		libchess::Move curm;
+			if (pv_node && reduction > 0)
+				reduction--;
 
-		bool check_after_move = pos.in_check();
+			if (reduction > 0) {
+				is_lmr = true;
+				new_depth = std::max(full_depth - reduction, 0);
+			}
+		}
+#else
+		const bool is_lmr = false;
+#endif
 
-		if (check_after_move)
-			goto skip_lmr;
+#ifdef WITH_PVS
+		if (n_played == 1)
+			score = -search<child_nt>(pos, full_depth, -beta, -alpha, is_null_move, meta, &curm);
+		else {
+			// scout: only prove that the move is not better than alpha
+			score = -search<NT_NONPV>(pos, new_depth, -alpha - 1, -alpha, is_null_move, meta, &curm);
 
-		score = -search(pos, new_depth + extension, -beta, -alpha, is_null_move, meta, &curm);
+			if (is_lmr && score > alpha)
+				score = -search<NT_NONPV>(pos, full_depth, -alpha - 1, -alpha, is_null_move, meta, &curm);
 
-		if (is_lmr && score > alpha) {
-		skip_lmr:
-			score = -search(pos, depth - 1, -beta, -alpha, is_null_move, meta, &curm);
+			// it is, so get its real score (a null window has no "inside")
+			if (pv_node && score > alpha && score < beta)
+				score = -search<NT_PV>(pos, full_depth, -beta, -alpha, is_null_move, meta, &curm);
 		}
 #else
-		score = -search(pos, depth - 1 + extension, -beta, -alpha, is_null_move, meta, &curm);
+		score = -search<child_nt>(pos, new_depth, -beta, -alpha, is_null_move, meta, &curm);
+
+		if (is_lmr && score > alpha)
+			score = -search<child_nt>(pos, full_depth, -beta, -alpha, is_null_move, meta, &curm);
 #endif
 
-		pos.unmake_move();
+		undo_move(pos, meta);
 
 		if (score > best_score) {
 			best_score = score;
@@ -370,13 +785,30 @@ int search(libchess::Position & pos, int depth, int alpha, int beta, bool is_nul
 			if (score > alpha) {
 				alpha = score;
 
+				if (pv_node)
+					update_pv(meta, move);
+
 				if (score >= beta) {
 					meta->bco_1st_move += n_played == 1;
 					meta->bco_total++;
 					meta->bco_index += n_played;
-
-					if (!pos.is_capture_move(move))
-						meta -> hbt[pos.side_to_move()][move.from_square()][move.to_square()] += depth * depth;
+					meta->bco_stage[mp.get_kind()]++;
+					meta->bco_before_quiets += !mp.quiets_generated();
+
+					if (meta->hist)
+						update_histories(pos, meta, move, depth);
+
+					if (!pos.is_capture_move(move)) {
+						if (!pos.is_promotion_move(move)) {
+							if (killers[0] != move) {
+								killers[1] = killers[0];
+								killers[0] = move;
+							}
+
+							if (countermove)
+								*countermove = move;
+						}
+					}
 					break;
 				}
 			}
@@ -452,12 +884,25 @@ bool time_management(int depth, std::chrono::time_point<std::chrono::system_cloc
 
 void search_it(std::vector<struct ponder_pars *> *td, int me, tt *tti, const int think_time, const int max_depth)
 {
-	meta_t meta;
+	meta_t & meta = *get_meta(me);
 	meta.ei = &td->at(me)->ei;
 	meta.node_count = 0;
-	meta.bco_index = meta.bco_1st_move = meta.bco_total = 0;
+	meta.bco_index = meta.bco_1st_move = meta.bco_total = meta.bco_before_quiets = 0;
+	memset(meta.bco_stage, 0x00, sizeof(meta.bco_stage));
 	meta.tti = tti;
-	memset(meta.hbt, 0x00, sizeof(meta.hbt));
+#ifndef __ANDROID__
+	// the caches are kept between searches: report the hit rates of this one
+	const uint64_t ph_lookups = meta.ph->get_lookups(), ph_hits = meta.ph->get_hits();
+	const uint64_t ec_lookups = meta.ec->get_lookups(), ec_hits = meta.ec->get_hits();
+#endif
+	meta.hist = get_history(me);
+	meta.hist->age();
+	memset(&meta.tt_stats, 0x00, sizeof(meta.tt_stats));
+#ifdef COUNT_ALLOCATIONS
+	meta.allocations = 0;
+#endif
+
+	collect_game_keys(&meta, td->at(me)->pos);
 
 	std::thread *t = nullptr;
 	if (max_depth == -1)
@@ -478,8 +923,16 @@ void search_it(std::vector<struct ponder_pars *> *td, int me, tt *tti, const int
 		if (time_management(td->at(me)->depth, start_ts, think_time, meta.ei->flag, me != 0))
 			break;
 
+		reset_search_stack(&meta, td->at(me)->pos);
+
 		libchess::Move cur_move;
-		int score = search(td->at(me)->pos, td->at(me)->depth, alpha, beta, false, &meta, &cur_move);
+#ifdef COUNT_ALLOCATIONS
+		uint64_t allocations_before = n_allocations;
+#endif
+		int score = search<NT_ROOT>(td->at(me)->pos, td->at(me)->depth, alpha, beta, false, &meta, &cur_move);
+#ifdef COUNT_ALLOCATIONS
+		meta.allocations += n_allocations - allocations_before;
+#endif
 
 		if (meta.ei->flag) { // FIXME logging
 			dolog("abort flag set");
@@ -509,18 +962,22 @@ void search_it(std::vector<struct ponder_pars *> *td, int me, tt *tti, const int
 			if (beta > 10000)
 				beta = 10000;
 
+			// normally the root pv starts with cur_move; it can be
+			// empty when the iteration got aborted
+			const search_frame_t & root = meta.stack[0];
+			bool pv_valid = root.pv_length > 0 && root.pv[0] == cur_move;
+
 			selected_move = true;
 			td->at(me)->result.m = cur_move;
 			td->at(me)->result.score = score;
 			td->at(me)->result.depth = td->at(me)->depth;
+			td->at(me)->result.ponder_move = pv_valid && root.pv_length >= 2 ? root.pv[1] : libchess::Move();
 
 			auto now_ts = std::chrono::system_clock::now();
 			std::chrono::duration<double> diff_ts = now_ts - start_ts;
 
 			if (diff_ts.count()) {
-				auto pv = get_pv_from_tt(tti, td->at(me)->pos, cur_move);
-
-				std::string moves = pv_to_string(pv);
+				std::string moves = pv_valid ? pv_to_string(root.pv, root.pv_length) : move_to_str(cur_move);
 
 				if (td->at(me)->is_ponder == false && me == 0) {
 					printf("info depth %d score cp %d nodes %ld time %d nps %d pv %s\n", td->at(me)->depth, score, meta.node_count, int(diff_ts.count() * 1000), int(meta.node_count / diff_ts.count()), moves.c_str());
@@ -557,15 +1014,38 @@ void search_it(std::vector<struct ponder_pars *> *td, int me, tt *tti, const int
 
 	dolog("thread stops %d", me);
 
+	td->at(me)->result.node_count = meta.node_count;
+	td->at(me)->result.bco_total = meta.bco_total;
+	td->at(me)->result.bco_index = meta.bco_index;
+#ifdef COUNT_ALLOCATIONS
+	td->at(me)->result.allocations = meta.allocations;
+#endif
+
+	tti->add_stats(meta.tt_stats);
+
 #ifndef __ANDROID__
 	if (meta.bco_total && me == 0) {
 		auto time_used_chrono = std::chrono::system_clock::now() - start_ts;
 		uint64_t time_used_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_used_chrono).count();
 
 		printf("info string beta cut-off after %f avg moves. # bco moves: %d, %% of total: %.2f%%, %f/s\n", meta.bco_index / double(meta.bco_total), meta.bco_total, meta.bco_total * 100.0 / meta.node_count, meta.bco_total * 1000.0 / time_used_ms);
+
+		printf("info string beta cut-offs by stage: tt %.2f%%, captures %.2f%%, killers %.2f%%, countermoves %.2f%%, quiets %.2f%%, bad captures %.2f%%, evasions %.2f%%; quiet moves not generated for %.2f%%\n",
+				meta.bco_stage[MP_KIND_TT] * 100.0 / meta.bco_total, meta.bco_stage[MP_KIND_CAPTURE] * 100.0 / meta.bco_total,
+				meta.bco_stage[MP_KIND_KILLER] * 100.0 / meta.bco_total, meta.bco_stage[MP_KIND_COUNTERMOVE] * 100.0 / meta.bco_total,
+				meta.bco_stage[MP_KIND_QUIET] * 100.0 / meta.bco_total, meta.bco_stage[MP_KIND_BAD_CAPTURE] * 100.0 / meta.bco_total,
+				meta.bco_stage[MP_KIND_EVASION] * 100.0 / meta.bco_total, meta.bco_before_quiets * 100.0 / meta.bco_total);
+
+		printf("info string pawn hash hit rate: %.2f%%\n", (meta.ph->get_hits() - ph_hits) * 100.0 / std::max(meta.ph->get_lookups() - ph_lookups, uint64_t(1)));
+		printf("info string eval cache hit rate: %.2f%%\n", (meta.ec->get_hits() - ec_hits) * 100.0 / std::max(meta.ec->get_lookups() - ec_lookups, uint64_t(1)));
 	}
 #endif
 
+#ifdef COUNT_ALLOCATIONS
+	if (me == 0)
+		printf("info string heap allocations during search: %lu\n", meta.allocations);
+#endif
+
 	if (t) {
 		meta.ei->flag = true;
 		meta.ei->cv.notify_one();
@@ -589,7 +1069,7 @@ result_t lazy_smp_search(tt *tti, int n_threads, libchess::Position & pos, int t
 	for(int i=0; i<n_threads; i++)
 		td.at(i)->join_thread = new std::thread(search_it, &td, i, tti, think_time, max_depth);
 
-	result_t r{ { }, -1, -32767 };
+	result_t r{ { }, -1, -32767, 0 };
 
 	std::optional<libchess::Move> syzygy_move = probe_fathom(pos);
 
@@ -619,8 +1099,16 @@ result_t lazy_smp_search(tt *tti, int n_threads, libchess::Position & pos, int t
 			r.depth = t->result.depth;
 			r.score = t->result.score;
 			r.m = t->result.m;
+			r.ponder_move = t->result.ponder_move;
 		}
 
+		r.node_count += t->result.node_count;
+		r.bco_total += t->result.bco_total;
+		r.bco_index += t->result.bco_index;
+#ifdef COUNT_ALLOCATIONS
+		r.allocations += t->result.allocations;
+#endif
+
 		delete t->join_thread;
 	}
 
@@ -629,6 +1117,7 @@ result_t lazy_smp_search(tt *tti, int n_threads, libchess::Position & pos, int t
 		r.m = syzygy_move.value();
 		r.score = 0;
 		r.depth = 0;
+		r.ponder_move = libchess::Move();
 	}
 
 	return r;
@@ -654,7 +1143,7 @@ std::vector<struct ponder_pars *> * ponder(tt *tti, libchess::Position & pos, in
 
 result_t stop_ponder(std::vector<struct ponder_pars *> *vpp)
 {
-	result_t r { { }, -1, -32767 };
+	result_t r { { }, -1, -32767, 0 };
 
 	for(auto & pp : *vpp){
 		pp->ei.flag = true;
@@ -669,6 +1158,7 @@ result_t stop_ponder(std::vector<struct ponder_pars *> *vpp)
 			r.depth = pp->result.depth;
 			r.score = pp->result.score;
 			r.m = pp->result.m;
+			r.ponder_move = pp->result.ponder_move;
 		}
 
 		delete pp;
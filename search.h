@@ -1,5 +1,16 @@
 #include <condition_variable>
 #include "eval_par.h"
+#include "eval_cache.h"
+#include "history.h"
+#include "material.h"
+#include "move_picker.h"
+#include "pawn_hash.h"
+
+#define PAWN_HASH_ENTRIES 16384
+#define EVAL_CACHE_ENTRIES 65536
+
+#define MAX_PLY 256
+#define MAX_GAME_KEYS 100  // halfmoves() >= 100 is a draw anyway
 
 typedef struct
 {
@@ -8,6 +19,30 @@ typedef struct
 }
 end_indicator_t;
 
+// search-local state of one ply, kept alongside the libchess::Position by
+// do_move() / undo_move(); fixed size so that search() and qs() do not
+// allocate
+typedef struct
+{
+	material_state_t material;
+	libchess::Move move;        // the move played from this ply (0 for a null move)
+	continuation_history_t *continuation;  // continuation history of that move, nullptr if none
+	int static_eval;            // -32767 when not evaluated
+	libchess::Move killers[2];  // quiet moves that gave a beta cut-off at this ply
+	move_buffer_t move_buffer;
+
+	// the moves searched before the one that gave a cut-off get a history malus
+	libchess::Move quiets_tried[64], captures_tried[32];
+	int n_quiets_tried, n_captures_tried;
+
+	// triangular pv: the best line from this ply on, as found by the search
+	libchess::Move pv[MAX_PLY];
+	int pv_length;
+
+	uint64_t key;    // pos.hash()
+	int reversible;  // plies back (within the game too) that this position can repeat: no capture, pawn move or null move in between
+} search_frame_t;
+
 typedef struct
 {
 	end_indicator_t *ei;
@@ -15,20 +50,58 @@ typedef struct
 	int max_depth;
 
 	tt *tti;
+	pawn_hash *ph;  // per thread; nullptr when evaluating with other than the default parameters
+	eval_cache *ec;  // idem
 
 	uint64_t bco_1st_move, bco_total, bco_index;
+	uint64_t bco_stage[MP_N_KINDS], bco_before_quiets;  // which move picker stage gave the cut-off
+
+	tt_stats_t tt_stats;
+
+	history *hist;  // per thread and kept between searches; nullptr when tuning
+	libchess::Move countermoves[2][6][64];  // quiet reply that refuted [color][piece][to] of the previous move
+
+	int ply;
+	search_frame_t stack[MAX_PLY];
 
-	unsigned int hbt[2][64][64];
+	// keys of the game positions before the root, the most recent first
+	uint64_t game_keys[MAX_GAME_KEYS];
+	int n_game_keys;
+
+#ifdef COUNT_ALLOCATIONS
+	uint64_t allocations;  // made by search() and qs()
+#endif
 } meta_t;
 
+// search() and qs() are instantiated per node type so that the root and
+// window checks are resolved at compile time. NT_NONPV nodes are searched
+// with a null window and do not collect a pv.
+typedef enum { NT_ROOT, NT_PV, NT_NONPV } node_type_t;
+
 typedef struct
 {
 	libchess::Move m;
 	int depth, score;
+	long int node_count;
+	libchess::Move ponder_move;  // expected reply: the 2nd move of the pv
+	uint64_t bco_total, bco_index;  // for the average move number of a beta cut-off
+#ifdef COUNT_ALLOCATIONS
+	uint64_t allocations;
+#endif
 } result_t;
 
+void init_search();  // fills the LMR and cuckoo tables
+void clear_history();
+// once, for a new meta_t: reserves the move buffers, clears killers and countermoves
+void init_search_stack(meta_t *const meta);
+// once per search: the keys of the positions before the root, for repetitions
+void collect_game_keys(meta_t *const meta, const libchess::Position & pos);
+// per iteration: the root frame
+void reset_search_stack(meta_t *const meta, const libchess::Position & pos);
+void do_move(libchess::Position & pos, meta_t *const meta, const libchess::Move move);
+void undo_move(libchess::Position & pos, meta_t *const meta);
+// for the tuner: qs() of a root position, evaluating with "pars"
 int qs(libchess::Position & pos, int alpha, int beta, meta_t *meta, int qsdepth, libchess::Move *m, eval_par & pars = default_parameters);
-int search(libchess::Position & pos, int depth, int alpha, int beta, libchess::Move *const m);
 void search_it(std::vector<struct ponder_pars *> *td, int me, tt *tti, const int think_time, const int max_depth);
 libchess::Move pick_one(libchess::Position & pos);
 
@@ -39,7 +112,7 @@ struct ponder_pars
 	int thread_nr, depth{ 1 };
 	libchess::Position pos{ 0 };
 	end_indicator_t ei { false };
-	result_t result{ {}, -1, -32767 };
+	result_t result{ {}, -1, -32767, 0 };
 	std::thread *join_thread;
 	const bool is_ponder;
 
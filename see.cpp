@@ -0,0 +1,111 @@
+#include <algorithm>
+
+#include "libchess/Position.h"
+#include "eval_par.h"
+#include "eval.h"
+#include "see.h"
+
+// all pieces (of both colors) that attack "sq" with the given occupancy
+static libchess::Bitboard attackers_to(const libchess::Position & pos, const libchess::Square sq, const libchess::Bitboard occupancy)
+{
+	const libchess::Bitboard bishops = pos.piece_type_bb(libchess::constants::BISHOP) | pos.piece_type_bb(libchess::constants::QUEEN);
+	const libchess::Bitboard rooks   = pos.piece_type_bb(libchess::constants::ROOK)   | pos.piece_type_bb(libchess::constants::QUEEN);
+
+	return (libchess::lookups::pawn_attacks(sq, libchess::constants::BLACK) & pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::WHITE)) |
+		(libchess::lookups::pawn_attacks(sq, libchess::constants::WHITE) & pos.piece_type_bb(libchess::constants::PAWN, libchess::constants::BLACK)) |
+		(libchess::lookups::knight_attacks(sq) & pos.piece_type_bb(libchess::constants::KNIGHT)) |
+		(libchess::lookups::king_attacks(sq) & pos.piece_type_bb(libchess::constants::KING)) |
+		(libchess::lookups::bishop_attacks(sq, occupancy) & bishops) |
+		(libchess::lookups::rook_attacks(sq, occupancy) & rooks);
+}
+
+int see(const libchess::Position & pos, const libchess::Move move, const eval_par & pars)
+{
+	if (move.type() == libchess::Move::Type::CASTLING)
+		return 0;
+
+	const libchess::Square from = move.from_square();
+	const libchess::Square to   = move.to_square();
+
+	libchess::Bitboard occupancy = pos.occupancy_bb();
+
+	int gain[32];
+	int d = 0;
+
+	// what the first capture wins
+	if (move.type() == libchess::Move::Type::ENPASSANT) {
+		gain[0] = eval_piece(libchess::constants::PAWN, pars);
+
+		occupancy ^= libchess::Bitboard(pos.side_to_move() == libchess::constants::WHITE ? to - 8 : to + 8);
+	}
+	else {
+		auto victim = pos.piece_on(to);
+
+		gain[0] = victim.has_value() ? eval_piece(victim->type(), pars) : 0;
+	}
+
+	// value of the piece that now stands on "to"
+	int on_square = eval_piece(pos.piece_on(from)->type(), pars);
+
+	if (move.promotion_piece_type()) {
+		int promotion = eval_piece(*move.promotion_piece_type(), pars);
+
+		gain[0] += promotion - eval_piece(libchess::constants::PAWN, pars);
+		on_square = promotion;
+	}
+
+	occupancy ^= libchess::Bitboard(from);
+
+	const libchess::Bitboard bishops = pos.piece_type_bb(libchess::constants::BISHOP) | pos.piece_type_bb(libchess::constants::QUEEN);
+	const libchess::Bitboard rooks   = pos.piece_type_bb(libchess::constants::ROOK)   | pos.piece_type_bb(libchess::constants::QUEEN);
+
+	libchess::Bitboard attackers = attackers_to(pos, to, occupancy) & occupancy;
+
+	libchess::Color side = !pos.side_to_move();
+
+	while(d < 31) {
+		libchess::Bitboard own_attackers = attackers & pos.color_bb(side);
+		if (!own_attackers)
+			break;
+
+		// least valuable attacker
+		libchess::PieceType type = libchess::constants::PAWN;
+		libchess::Bitboard candidates;
+
+		for(libchess::PieceType t : libchess::constants::PIECE_TYPES) {
+			candidates = own_attackers & pos.piece_type_bb(t);
+
+			if (candidates) {
+				type = t;
+				break;
+			}
+		}
+
+		// the king can only take when nothing defends
+		if (type == libchess::constants::KING && (attackers & pos.color_bb(!side)))
+			break;
+
+		d++;
+		gain[d] = on_square - gain[d - 1];
+
+		// neither side can gain by continuing
+		if (std::max(-gain[d - 1], gain[d]) < 0)
+			break;
+
+		occupancy ^= libchess::Bitboard(candidates.forward_bitscan());
+		on_square = eval_piece(type, pars);
+
+		// x-rays
+		attackers |= (libchess::lookups::bishop_attacks(to, occupancy) & bishops) | (libchess::lookups::rook_attacks(to, occupancy) & rooks);
+		attackers &= occupancy;
+
+		side = !side;
+	}
+
+	while(d > 0) {
+		gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+		d--;
+	}
+
+	return gain[0];
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "libchess/Position.h"
+#include "eval_par.h"
+
+// static exchange evaluation: the material balance (for the side to move) of
+// "move" followed by the cheapest recaptures on its target square, where each
+// side may stop capturing when that is better. sliders behind a piece that
+// captures (x-rays) join in. pins are not looked at.
+int see(const libchess::Position & pos, const libchess::Move move, const eval_par & pars);
@@ -1,75 +1,483 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 
 #include "libchess/Position.h"
 #include "tt.h"
+#include "utils.h"
 
-tt::tt(size_t size_in_bytes) : entries(nullptr)
+#define HUGE_PAGE_2M (2ll * 1024ll * 1024ll)
+#define HUGE_PAGE_1G (1024ll * 1024ll * 1024ll)
+
+// from linux/mempolicy.h, not every libc ships numaif.h
+#define TT_MPOL_BIND       2
+#define TT_MPOL_INTERLEAVE 3
+#define TT_MAX_NUMA_NODES  1024
+
+tt::tt(size_t size_in_bytes, const bool large_pages, const tt_numa_policy numa_policy, const int numa_node, const int n_threads) : entries(nullptr), n_entries(0), mapping(nullptr), alloc_size(0), large_pages(large_pages), numa_policy(numa_policy), numa_node(numa_node), page_kind("none"), shared(false), attached_existing(false), owner(false), prefetch_enabled(true), age(0), shared_header(nullptr)
 {
-	resize(size_in_bytes);
+	reset_stats();
+
+	resize(size_in_bytes, n_threads);
 }
 
 tt::~tt()
 {
-	delete [] entries;
+	free_table();
+
+	unlink_shared();
+}
+
+void tt::free_table()
+{
+	if (mapping)
+		munmap(mapping, alloc_size);
+
+	entries = nullptr;
+	n_entries = 0;
+	mapping = nullptr;
+	alloc_size = 0;
+	shared_header = nullptr;
+}
+
+// remove the shared memory segment if this process created it; processes
+// that have it mapped keep their mapping, new ones get a fresh segment
+void tt::unlink_shared()
+{
+#ifndef __ANDROID__
+	if (owner) {
+		std::string name = shm_name.at(0) == '/' ? shm_name : "/" + shm_name;
+
+		if (shm_unlink(name.c_str()) == -1)
+			dolog("shm_unlink(%s) failed: %s", name.c_str(), strerror(errno));
+		else
+			dolog("removed shared tt %s", name.c_str());
+	}
+#endif
+
+	owner = false;
+}
+
+static void *map_anonymous(const size_t size, const int extra_flags)
+{
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+
+	return p == MAP_FAILED ? nullptr : p;
+}
+
+// like map_anonymous() but starting on a 2MB boundary, so that transparent
+// huge pages can back all of it and not only the aligned interior: maps 2MB
+// more and gives back the unaligned head and the tail
+static void *map_anonymous_aligned(const size_t size, const int prot)
+{
+	const size_t total = size + HUGE_PAGE_2M;
+
+	void *p = mmap(nullptr, total, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+
+	const uintptr_t start   = uintptr_t(p);
+	const uintptr_t aligned = (start + HUGE_PAGE_2M - 1) & ~uintptr_t(HUGE_PAGE_2M - 1);
+
+	if (aligned > start)
+		munmap(p, aligned - start);
+
+	const size_t tail = start + total - (aligned + size);
+	if (tail)
+		munmap(reinterpret_cast<void *>(aligned + size), tail);
+
+	return reinterpret_cast<void *>(aligned);
+}
+
+// map the named POSIX shared memory segment: a tt_shared_header followed by
+// the buckets. the process that creates it sets the size. an existing segment
+// of another size is recreated when this process made it and is otherwise
+// used as it is.
+bool tt::allocate_shared(size_t bytes)
+{
+#ifdef __ANDROID__
+	dolog("shared memory tt not supported on this platform");
+	return false;
+#else
+	std::string name = shm_name.at(0) == '/' ? shm_name : "/" + shm_name;
+
+	size_t seg_size = sizeof(tt_shared_header) + bytes;
+
+	bool created = true;
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if (fd == -1 && errno == EEXIST) {
+		created = false;
+		fd = shm_open(name.c_str(), O_RDWR, 0600);
+	}
+
+	if (fd == -1) {
+		dolog("shm_open(%s) failed: %s", name.c_str(), strerror(errno));
+		return false;
+	}
+
+	if (!created) {
+		struct stat st { };
+
+		// the creator may not have set the size yet
+		for(int i=0; i<100; i++) {
+			if (fstat(fd, &st) == -1 || st.st_size)
+				break;
+
+			usleep(10000);
+		}
+
+		if (st.st_size < off_t(sizeof(tt_shared_header) + sizeof(tt_hash_group))) {
+			dolog("shared tt %s has no size", name.c_str());
+			close(fd);
+			return false;
+		}
+
+		if (size_t(st.st_size) != seg_size && owner) {
+			// ours from before a Hash change: start over with the new size
+			close(fd);
+
+			shm_unlink(name.c_str());
+
+			created = true;
+			fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+			if (fd == -1) {
+				dolog("shm_open(%s) failed: %s", name.c_str(), strerror(errno));
+				owner = false;
+				return false;
+			}
+		}
+		else if (size_t(st.st_size) != seg_size) {
+			size_t has = st.st_size - sizeof(tt_shared_header);
+			has -= has % sizeof(tt_hash_group);
+
+			printf("info string shared tt %s is %zu MB instead of the requested %zu MB; the process that created it decides the size\n", name.c_str(), has / 1024 / 1024, bytes / 1024 / 1024);
+			dolog("shared tt %s: %zu bytes instead of %zu", name.c_str(), has, bytes);
+
+			bytes = has;
+			seg_size = sizeof(tt_shared_header) + bytes;
+		}
+	}
+
+	if (created) {
+		owner = true;
+
+		if (ftruncate(fd, seg_size) == -1) {
+			dolog("cannot size shared tt %s: %s", name.c_str(), strerror(errno));
+			close(fd);
+			unlink_shared();
+			return false;
+		}
+	}
+
+	// with huge pages, place the segment in a 2MB aligned range
+	void *range = large_pages && bytes >= HUGE_PAGE_2M ? map_anonymous_aligned(seg_size, PROT_NONE) : nullptr;
+
+	void *p = mmap(range, seg_size, PROT_READ | PROT_WRITE, MAP_SHARED | (range ? MAP_FIXED : 0), fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		dolog("mmap of shared tt %s failed: %s", name.c_str(), strerror(errno));
+
+		if (range)
+			munmap(range, seg_size);
+
+		if (created)
+			unlink_shared();
+
+		return false;
+	}
+
+	page_kind = "shared 4kB";
+
+#ifdef MADV_HUGEPAGE
+	// only has effect when /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it
+	if (large_pages && bytes >= HUGE_PAGE_2M && madvise(p, seg_size, MADV_HUGEPAGE) == 0)
+		page_kind = "shared transparent 2MB";
+#endif
+
+	mapping = p;
+	alloc_size = seg_size;
+	shared_header = reinterpret_cast<tt_shared_header *>(p);
+	entries = reinterpret_cast<tt_hash_group *>(reinterpret_cast<char *>(p) + sizeof(tt_shared_header));
+	n_entries = bytes / sizeof(tt_hash_group);
+	shared = true;
+	attached_existing = !created;
+
+	dolog("%s shared tt %s", created ? "created" : "attached to", name.c_str());
+
+	return true;
+#endif
+}
+
+void tt::allocate(size_t size_in_bytes)
+{
+	size_t bytes = std::max(size_in_bytes / sizeof(tt_hash_group), size_t(1)) * sizeof(tt_hash_group);
+	void *p = nullptr;
+	size_t mapped = bytes;  // can be more than the table, for page granularity
+
+	shared = attached_existing = false;
+
+	if (!shm_name.empty()) {
+		if (allocate_shared(bytes))
+			return;
+
+		dolog("falling back to a private tt");
+	}
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+	// explicit huge pages: only available when reserved (vm.nr_hugepages), so
+	// failing here is normal
+	if (large_pages && bytes % HUGE_PAGE_1G == 0) {
+		p = map_anonymous(bytes, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+		page_kind = "1GB";
+	}
+
+	if (!p && large_pages && bytes >= HUGE_PAGE_2M) {
+		// the mapping must be a whole number of huge pages; the table keeps
+		// the requested size
+		size_t rounded = (bytes + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M * HUGE_PAGE_2M;
+
+		p = map_anonymous(rounded, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT));
+		if (p)
+			mapped = rounded;
+		page_kind = "2MB";
+	}
+#endif
+
+	if (!p) {
+		p = large_pages && bytes >= HUGE_PAGE_2M ? map_anonymous_aligned(bytes, PROT_READ | PROT_WRITE) : map_anonymous(bytes, 0);
+		page_kind = "4kB";
+
+#ifdef MADV_HUGEPAGE
+		// fall back to transparent huge pages
+		if (p && large_pages && bytes >= HUGE_PAGE_2M && madvise(p, bytes, MADV_HUGEPAGE) == 0)
+			page_kind = "transparent 2MB";
+#endif
+	}
+
+	if (!p)
+		throw std::bad_alloc();
+
+	mapping = p;
+	entries = reinterpret_cast<tt_hash_group *>(p);
+	n_entries = bytes / sizeof(tt_hash_group);
+	alloc_size = mapped;
+}
+
+static std::vector<int> get_online_numa_nodes()
+{
+	std::vector<int> out;
+
+	std::ifstream fh("/sys/devices/system/node/online");
+
+	std::string line;
+	if (!std::getline(fh, line))
+		return out;
+
+	// e.g. "0-3" or "0,2-3"
+	std::vector<std::string> *parts = split(line, ",");
+
+	for(auto & part : *parts) {
+		size_t dash = part.find('-');
+
+		int first = atoi(part.c_str());
+		int last = dash == std::string::npos ? first : atoi(part.substr(dash + 1).c_str());
+
+		for(int node=first; node<=last && node < TT_MAX_NUMA_NODES; node++)
+			out.push_back(node);
+	}
+
+	delete parts;
+
+	return out;
+}
+
+void tt::apply_numa_policy()
+{
+	if (numa_policy == TT_NUMA_NONE)
+		return;
+
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long mask[TT_MAX_NUMA_NODES / (sizeof(unsigned long) * 8)] { 0 };
+	constexpr int bits_per_word = sizeof(unsigned long) * 8;
+
+	std::vector<int> nodes = get_online_numa_nodes();
+
+	if (numa_policy == TT_NUMA_INTERLEAVE) {
+		if (nodes.size() < 2)
+			return;
+
+		for(int node : nodes)
+			mask[node / bits_per_word] |= 1ul << (node % bits_per_word);
+	}
+	else {
+		if (std::find(nodes.begin(), nodes.end(), numa_node) == nodes.end()) {
+			dolog("NUMA node %d is not online", numa_node);
+			return;
+		}
+
+		mask[numa_node / bits_per_word] |= 1ul << (numa_node % bits_per_word);
+	}
+
+	// pages are not touched yet (mmap is lazy) so they are placed on first fault
+	if (syscall(SYS_mbind, mapping, alloc_size, numa_policy == TT_NUMA_INTERLEAVE ? TT_MPOL_INTERLEAVE : TT_MPOL_BIND, mask, TT_MAX_NUMA_NODES, 0) == -1)
+		dolog("mbind failed: %s", strerror(errno));
+#else
+	dolog("NUMA policy not supported on this platform");
+#endif
+}
+
+void tt::set_memory_policy(const bool large_pages, const tt_numa_policy numa_policy, const int numa_node)
+{
+	this->large_pages = large_pages;
+	this->numa_policy = numa_policy;
+	this->numa_node = numa_node;
+}
+
+void tt::set_shared_name(const std::string & name)
+{
+	if (name != shm_name)
+		unlink_shared();
+
+	shm_name = name;
+}
+
+void tt::resize(size_t size_in_bytes, const int n_threads)
+{
+	free_table();
+
+	allocate(size_in_bytes);
+
+	apply_numa_policy();
+
+	// anonymous mappings are already zero-filled, but clearing them from
+	// all threads faults the pages in now (and on the node of each thread)
+	// instead of during the first search; a shared table that other
+	// processes already use is left alone
+	if (!attached_existing)
+		clear(n_threads);
+
+	dolog("tt: %zu bytes (%zu mapped), %s pages", get_size(), alloc_size, page_kind);
 }
 
-void tt::resize(size_t size_in_bytes)
+void tt::clear(const int n_threads)
 {
-	if (entries)
-		delete [] entries;
+	uint64_t n_work = std::max(std::min(uint64_t(n_threads), n_entries), uint64_t(1));
+	uint64_t per_thread = n_entries / n_work;
+
+	std::vector<std::thread *> threads;
+
+	for(uint64_t i=0; i<n_work; i++) {
+		uint64_t start = i * per_thread;
+		uint64_t n = i == n_work - 1 ? n_entries - start : per_thread;
 
-	n_entries = size_in_bytes / sizeof(tt_hash_group);
-	entries = new tt_hash_group[n_entries];
-	memset(entries, 0x00, sizeof(tt_hash_group) * n_entries);
+		threads.push_back(new std::thread([this, start, n] { memset(&entries[start], 0x00, n * sizeof(tt_hash_group)); }));
+	}
+
+	for(auto & t : threads) {
+		t->join();
+		delete t;
+	}
 
-	age = 0;
+	set_age(0);
+}
+
+void tt::set_age(const int new_age)
+{
+	if (shared_header)
+		__atomic_store_n(&shared_header->age, uint32_t(new_age), __ATOMIC_RELAXED);
+	else
+		age = new_age;
 }
 
 void tt::inc_age()
 {
-	age++;
+	// a shared table ages when any of its processes starts a search
+	if (shared_header)
+		__atomic_fetch_add(&shared_header->age, 1, __ATOMIC_RELAXED);
+	else
+		age = (age + 1) & 63;  // width of tt_entry::age
 }
 
 std::optional<tt_entry> tt::lookup(const uint64_t hash)
 {
-	uint64_t index = hash % n_entries;
-
-	tt_entry *const e = entries[index].entries;
+	tt_entry *const e = entries[get_index(hash)].entries;
+	const uint16_t key = uint16_t(hash);
+	const int cur_age = get_age();
 
 	for(int i=0; i<N_TE_PER_HASH_GROUP; i++) {
-		tt_entry *const cur = &e[i];
+		tt_entry cur;
+		cur.data_.data = __atomic_load_n(&e[i].data_.data, __ATOMIC_RELAXED);
 
-		if ((cur -> hash ^ cur -> data_.data) == hash) {
-			cur->data_._data.age = age;
-			cur->hash = hash ^ cur->data_.data;
+		if (cur.data_._data.key == key && cur.data_._data.flags != NOTVALID) {
+			// only write when the age changes: a hit should not dirty a
+			// cache line that the other threads are reading as well
+			if (cur.data_._data.age != cur_age) {
+				cur.data_._data.age = cur_age;
+				__atomic_store_n(&e[i].data_.data, cur.data_.data, __ATOMIC_RELAXED);
+			}
 
-			return *cur;
+			return cur;
 		}
 	}
 
 	return { };
 }
 
-void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const libchess::Move & m)
+// replacement value of an entry: deep, recent and exact is worth keeping
+static int replacement_value(const tt_entry & e, const int age)
 {
-	unsigned long int index = hash % n_entries; // FIXME is biased at the bottom of the list
+	if (e.data_._data.flags == NOTVALID)
+		return INT_MIN;
+
+	int age_distance = (age - e.data_._data.age) & 63;  // age wraps at 6 bits
+
+	int value = e.data_._data.depth - age_distance * 8;
+
+	if (e.data_._data.flags == EXACT && e.data_._data.depth > TT_QS_DEPTH)
+		value += age_distance == 0 ? 1024 : 2;  // pv nodes of this search are always kept
+
+	return value;
+}
 
-	tt_entry *const e = entries[index].entries;
+void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const libchess::Move & m)
+{
+	tt_entry *const e = entries[get_index(hash)].entries;
+	const uint16_t key = uint16_t(hash);
+	const int cur_age = get_age();
 
-	int useSubIndex = -1, minDepth = 999, mdi = -1;
+	int useSubIndex = -1, minValue = INT_MAX;
 
 	for(int i=0; i<N_TE_PER_HASH_GROUP; i++)
 	{
-		if ((e[i].hash ^ e[i].data_.data) == hash) {
-			if (e[i].data_._data.depth > d) {
-				e[i].data_._data.age = age;
-				e[i].hash = hash ^ e[i].data_.data;
-				return;
-			}
-			if (f!=EXACT && e[i].data_._data.depth==d) {
-				e[i].data_._data.age = age;
-				e[i].hash = hash ^ e[i].data_.data;
+		tt_entry cur;
+		cur.data_.data = __atomic_load_n(&e[i].data_.data, __ATOMIC_RELAXED);
+
+		if (cur.data_._data.key == key && cur.data_._data.flags != NOTVALID) {
+			// a deeper result stays, as does an as deep one unless the new one is exact
+			if (cur.data_._data.depth > d || (f != EXACT && cur.data_._data.depth == d)) {
+				if (cur.data_._data.age != cur_age) {
+					cur.data_._data.age = cur_age;
+					__atomic_store_n(&e[i].data_.data, cur.data_.data, __ATOMIC_RELAXED);
+				}
+
 				return;
 			}
 
@@ -78,25 +486,114 @@ void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const in
 			break;
 		}
 
-		if (e[i].data_._data.age != age)
+		int value = replacement_value(cur, cur_age);
+
+		if (value < minValue) {
+			minValue = value;
 			useSubIndex = i;
-		else if (e[i].data_._data.depth < minDepth) {
-			minDepth = e[i].data_._data.depth;
-			mdi = i;
 		}
 	}
 
-	if (useSubIndex == -1)
-		useSubIndex = mdi;
+	if (d == TT_QS_DEPTH) {
+		tt_entry victim;
+		victim.data_.data = __atomic_load_n(&e[useSubIndex].data_.data, __ATOMIC_RELAXED);
+
+		if (victim.data_._data.flags != NOTVALID && victim.data_._data.depth > TT_QS_DEPTH && victim.data_._data.age == cur_age)
+			return;
+	}
+
+	tt_entry n;
+	n.data_._data.key = key;
+	n.data_._data.m = tt_pack_move(m);
+	n.data_._data.score = int16_t(score);
+	n.data_._data.depth = uint8_t(d);
+	n.data_._data.flags = f;
+	n.data_._data.age = cur_age;
+
+	__atomic_store_n(&e[useSubIndex].data_.data, n.data_.data, __ATOMIC_RELAXED);
+}
+
+bool tt::save(const std::string & file) const
+{
+	FILE *fh = fopen(file.c_str(), "wb");
+	if (!fh) {
+		dolog("cannot create %s: %s", file.c_str(), strerror(errno));
+		return false;
+	}
+
+	tt_file_header header { TT_FILE_MAGIC, TT_FILE_VERSION, sizeof(tt_hash_group), n_entries, uint32_t(get_age()) };
+
+	bool ok = fwrite(&header, sizeof header, 1, fh) == 1 && fwrite(entries, sizeof(tt_hash_group), n_entries, fh) == n_entries;
+
+	if (fclose(fh) != 0)
+		ok = false;
+
+	if (!ok)
+		dolog("failed writing %s: %s", file.c_str(), strerror(errno));
+
+	return ok;
+}
+
+bool tt::load(const std::string & file)
+{
+	FILE *fh = fopen(file.c_str(), "rb");
+	if (!fh) {
+		dolog("cannot open %s: %s", file.c_str(), strerror(errno));
+		return false;
+	}
+
+	tt_file_header header;
+
+	if (fread(&header, sizeof header, 1, fh) != 1 || memcmp(header.magic, TT_FILE_MAGIC, sizeof header.magic) != 0 || header.version != TT_FILE_VERSION || header.bucket_size != sizeof(tt_hash_group)) {
+		dolog("%s is not a (compatible) tt snapshot", file.c_str());
+		fclose(fh);
+		return false;
+	}
+
+	if (header.n_buckets != n_entries) {
+		dolog("%s holds a tt of %lu bytes, current tt is %zu bytes", file.c_str(), header.n_buckets * sizeof(tt_hash_group), get_size());
+		fclose(fh);
+		return false;
+	}
+
+	bool ok = fread(entries, sizeof(tt_hash_group), n_entries, fh) == n_entries;
+
+	fclose(fh);
+
+	if (ok)
+		set_age(header.age & 63);
+	else {
+		dolog("%s is truncated", file.c_str());
+		clear(1);
+	}
 
-	tt_entry *const cur = &e[useSubIndex];
-	tt_entry::u n;
-	n._data.score = int16_t(score);
-	n._data.depth = uint8_t(d);
-	n._data.flags = f;
-	n._data.age = age;
-	n._data.m = m.value();
+	return ok;
+}
 
-	cur -> hash = hash ^ n.data;
-	cur -> data_.data = n.data;
+void tt::add_stats(const tt_stats_t & thread_stats)
+{
+	for(int i=0; i<TT_STATS_DEPTH; i++) {
+		__atomic_fetch_add(&stats.probes[i], thread_stats.probes[i], __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.hits[i], thread_stats.hits[i], __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.cutoffs[i], thread_stats.cutoffs[i], __ATOMIC_RELAXED);
+	}
+}
+
+void tt::reset_stats()
+{
+	memset(&stats, 0x00, sizeof stats);
+}
+
+void tt::get_depth_histogram(uint64_t *const counts, const int n) const
+{
+	memset(counts, 0x00, sizeof(uint64_t) * n);
+
+	for(uint64_t i=0; i<n_entries; i++) {
+		for(int j=0; j<N_TE_PER_HASH_GROUP; j++) {
+			const tt_entry & cur = entries[i].entries[j];
+
+			if (cur.data_._data.flags != NOTVALID)
+				counts[std::min(int(cur.data_._data.depth), n - 1)]++;
+		}
+	}
 }
@@ -4,17 +4,18 @@
 
 typedef enum { NOTVALID = 0, EXACT = 1, LOWERBOUND = 2, UPPERBOUND = 3 } tt_entry_flag;
 
-typedef struct __PRAGMA_PACKED__
+// one entry is a single 64 bit word so that it is read and written
+// atomically: no need to verify it against torn writes by other threads
+typedef struct
 {
-        uint64_t hash;
-
         union u {
-                struct {
+                struct __PRAGMA_PACKED__ {
+                        uint16_t key;  // lower 16 bits of the board hash
+                        uint16_t m;  // see tt_pack_move()
                         int16_t score;
                         uint8_t flags : 2;
                         uint8_t age : 6;
                         uint8_t depth : 8;
-                        uint32_t m;
                 } _data;
 
                 uint64_t data;
@@ -23,27 +24,131 @@ typedef struct __PRAGMA_PACKED__
 
 #define N_TE_PER_HASH_GROUP 8
 
-typedef struct __PRAGMA_PACKED__
+// depth of entries stored by qs(); main search entries are at least 1 deep.
+// such entries only take the place of empty, stale or other qs entries.
+#define TT_QS_DEPTH 0
+
+// a bucket is exactly one cache line
+typedef struct alignas(64)
 {
         tt_entry entries[N_TE_PER_HASH_GROUP];
 } tt_hash_group;
 
+static_assert(sizeof(tt_entry) == 8, "tt_entry must be 8 bytes");
+static_assert(sizeof(tt_hash_group) == 64, "tt_hash_group must be one cache line");
+
+// from (6 bits), to (6 bits), promotion piece type (3 bits); 0 is "no move"
+inline uint16_t tt_pack_move(const libchess::Move & m)
+{
+	if (m.value() == 0)
+		return 0;
+
+	auto promotion = m.promotion_piece_type();
+
+	return m.from_square() | (m.to_square() << 6) | ((promotion.has_value() ? int(promotion.value()) : 0) << 12);
+}
+
+#define TT_FILE_MAGIC   "MicahTT"
+#define TT_FILE_VERSION 1
+
+// header of a tt snapshot on disk, followed by the buckets as-is
+typedef struct __PRAGMA_PACKED__
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t bucket_size;
+	uint64_t n_buckets;
+	uint32_t age;
+} tt_file_header;
+
+#define TT_STATS_DEPTH 64
+
+// per search depth: how often the tt was probed, had the position and gave
+// a cut-off
+typedef struct
+{
+	uint64_t probes[TT_STATS_DEPTH], hits[TT_STATS_DEPTH], cutoffs[TT_STATS_DEPTH];
+} tt_stats_t;
+
+// start of a shared table, followed by the buckets: what all processes using
+// it must agree on
+typedef struct alignas(64)
+{
+	uint32_t age;  // searches started by any of the processes; tt_entry::age holds the lower 6 bits
+} tt_shared_header;
+
+// how the pages of the table are spread over the NUMA nodes
+typedef enum { TT_NUMA_NONE = 0, TT_NUMA_INTERLEAVE = 1, TT_NUMA_BIND = 2 } tt_numa_policy;
+
 class tt
 {
 private:
 	tt_hash_group *entries;
 	uint64_t n_entries;
+	void *mapping;  // for munmap(); the header of a shared table comes before the entries
+	size_t alloc_size;  // of the mapping; can exceed the table
+
+	bool large_pages;
+	tt_numa_policy numa_policy;
+	int numa_node;
+	const char *page_kind;
+	std::string shm_name;
+	bool shared, attached_existing;
+	bool owner;  // this process created the segment of shm_name: it removes it again
+	bool prefetch_enabled;
+
+	int age;  // private table
+	tt_shared_header *shared_header;  // nullptr for a private table
+
+	int get_age() const { return shared_header ? int(__atomic_load_n(&shared_header->age, __ATOMIC_RELAXED) & 63) : age; }
+	void set_age(const int new_age);
+	void unlink_shared();
 
-	int age;
+	tt_stats_t stats;
+
+	// multiply-high instead of a modulo: no division and no bias
+	uint64_t get_index(const uint64_t hash) const { return uint64_t((unsigned __int128)hash * n_entries >> 64); }
+
+	bool allocate_shared(size_t bytes);
+	void allocate(size_t size_in_bytes);
+	void apply_numa_policy();
+	void free_table();
 
 public:
-	tt(size_t size_in_bytes);
+	tt(size_t size_in_bytes, const bool large_pages = true, const tt_numa_policy numa_policy = TT_NUMA_NONE, const int numa_node = 0, const int n_threads = 1);
 	~tt();
 
 	void inc_age();
 
-	void resize(size_t size_in_bytes);
+	void set_memory_policy(const bool large_pages, const tt_numa_policy numa_policy, const int numa_node);
+	// put the table in a named POSIX shared memory segment ("" = private);
+	// a segment that this process created is removed when the name changes
+	// (also to "") and when the tt is destroyed. processes that still have
+	// it mapped keep using it.
+	void set_shared_name(const std::string & name);
+	bool is_shared() const { return shared; }
+	void resize(size_t size_in_bytes, const int n_threads = 1);
+	void clear(const int n_threads);
+
+	size_t get_size() const { return n_entries * sizeof(tt_hash_group); }
+	const char *get_page_kind() const { return page_kind; }
+
+	void set_prefetch(const bool enabled) { prefetch_enabled = enabled; }
+
+	// start loading the bucket of a position that is about to be searched
+	void prefetch(const uint64_t hash) const {
+		if (prefetch_enabled)
+			__builtin_prefetch(&entries[get_index(hash)]);
+	}
 
 	std::optional<tt_entry> lookup(const uint64_t board_hash);
 	void store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const libchess::Move & m);
+
+	bool save(const std::string & file) const;
+	bool load(const std::string & file);
+
+	void add_stats(const tt_stats_t & thread_stats);
+	const tt_stats_t & get_stats() const { return stats; }
+	void reset_stats();
+	void get_depth_histogram(uint64_t *const counts, const int n) const;
 };
@@ -1,4 +1,6 @@
 #include <cstdarg>
+#include <cstdlib>
+#include <new>
 #include <string>
 #include <vector>
 #include <unistd.h>
@@ -141,45 +143,6 @@ std::vector<std::string> * split(std::string in, std::string splitter)
 	return out;
 }
 
-bool is_move_in_movelist(libchess::MoveList & move_list, libchess::Move & m)
-{
-	return std::any_of(move_list.begin(), move_list.end(), [m](const libchess::Move & move) {
-			return move.from_square() == m.from_square() &&
-			move.to_square() == m.to_square() &&
-			move.promotion_piece_type() == m.promotion_piece_type();
-			});
-}
-
-std::vector<pv_entry_t> get_pv_from_tt(tt *tti, libchess::Position & pos_in, libchess::Move & cur_move)
-{
-	libchess::Position work = pos_in;
-
-	std::vector<pv_entry_t> out;
-	out.push_back({ work.hash(), cur_move });
-
-	work.make_move(cur_move);
-
-	for(int i=0; i<500; i++) {
-		std::optional<tt_entry> te = tti->lookup(work.hash());
-		if (!te.has_value())
-			break;
-
-		cur_move = libchess::Move(te.value().data_._data.m);
-
-		libchess::MoveList cur_moves = work.legal_move_list();
-		if (!is_move_in_movelist(cur_moves, cur_move))
-			break;
-
-		out.push_back({ work.hash(), cur_move });
-		work.make_move(cur_move);
-
-		if (work.is_repeat(3))
-			break;
-	}
-
-	return out;
-}
-
 std::string move_to_str(const libchess::Move & cur_move)
 {
 	std::ostringstream stream;
@@ -187,33 +150,20 @@ std::string move_to_str(const libchess::Move & cur_move)
 	return stream.str();
 }
 
-std::string pv_to_string(std::vector<pv_entry_t> & pv)
+std::string pv_to_string(const libchess::Move *const pv, const int n)
 {
 	std::string rc;
-	bool first = true;
 
-	for(pv_entry_t & cur : pv) {
-		if (first)
-			first = false;
-		else
+	for(int i=0; i<n; i++) {
+		if (i)
 			rc += " ";
 
-		rc += move_to_str(cur.move);
+		rc += move_to_str(pv[i]);
 	}
 
 	return rc;
 }
 
-libchess::Move find_pv_move_by_hash(std::vector<pv_entry_t> & pv, uint64_t hash)
-{
-	for(pv_entry_t cur : pv) {
-		if (cur.hash == hash)
-			return cur.move;
-	}
-
-	return libchess::Move();
-}
-
 uint64_t get_ts_ms()
 {
 	struct timeval tv;
@@ -221,3 +171,28 @@ uint64_t get_ts_ms()
 
 	return tv.tv_sec * 1000ll + tv.tv_usec / 1000;
 }
+
+#ifdef COUNT_ALLOCATIONS
+thread_local uint64_t n_allocations = 0;
+
+void *operator new(std::size_t size)
+{
+	n_allocations++;
+
+	void *p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	free(p);
+}
+#endif